@@ -3,8 +3,17 @@
               Written by Tsuyoshi HASEGAWA 2013-14
 *******************************************************/
 module HD63701V0_M6
+#(
+ // 0: the sci starts transmissions in 11 bit time slots like the
+ // original core did and SCI_TX_SLOTS is ignored, 1: SCI_TX_SLOTS
+ // selects it
+ parameter SCI_TX_SLOTS_PORT = 0
+)
 (
  input 	       CLKx2, // XTAL/EXTAL (200K~2.0MHz)
+ // clock enable of the timer and the sci. The core runs at CLKx2
+ // while they only advance on CLKx2 cycles with PERIPH_EN set
+ input 	       PERIPH_EN,
 
  input 	       RST, // RES
  input 	       NMI, // NMI
@@ -21,7 +30,25 @@ module HD63701V0_M6
  output [7:0]  PO1, //       OUT
 
  input [4:0]   PI2, // Port2 IN
- output [7:0]  PO2  //       OUT
+ output [7:0]  PO2, //       OUT
+
+ // 1: the sci only starts a transmission in fixed 11 bit time slots
+ // like the original core did, 0: on the next bit boundary. Only
+ // used with SCI_TX_SLOTS_PORT set
+ input 	       SCI_TX_SLOTS,
+
+ // debug: cpu state at the last instruction fetch
+ output [15:0] DBG_PC,
+ output [15:0] DBG_D,
+ output [15:0] DBG_X,
+ output [15:0] DBG_S,
+ output [5:0]  DBG_C,
+ output [31:0] DBG_ICNT,
+ output [7:0]  DBG_OP,
+ output [7:0]  DBG_TRCSR,
+ output [7:0]  DBG_RMCR,
+ output [7:0]  DBG_PO3,
+ output [7:0]  DBG_PO4
 );
 
 // map sci tx onto PO3 if transmitter is enabled
@@ -32,6 +59,9 @@ wire [15:0] ADI;
 wire [7:0] PO3;   
 wire [7:0] PO4;   
 
+assign DBG_PO3 = PO3;
+assign DBG_PO4 = PO4;
+
 // Multiplex PO3 and PO4 onto external AD port in mode 7
 assign AD = (PO2I[7:5] == 3'b111)?{ PO4, PO3 }:ADI;  
    
@@ -59,14 +89,15 @@ wire		  txd;
 wire		  te;
 wire		  en_bisci;
 wire [7:0] biscid;
-HD63701_SCI sci( RST, CLKx2, ADI, RW, DO, PI2[3], txd, te, irq2_sci, en_bisci, biscid );
+wire		  tx_slots = SCI_TX_SLOTS_PORT ? SCI_TX_SLOTS : 1'b1;
+HD63701_SCI sci( RST, CLKx2, PERIPH_EN, ADI, RW, DO, PI2[3], tx_slots, txd, te, irq2_sci, en_bisci, biscid, DBG_TRCSR, DBG_RMCR );
 
 
 // Built-In Timer
 wire		  irq2_tim;
 wire		  en_bitim;
 wire [7:0] bitimd;
-HD63701_Timer timer( RST, CLKx2, ADI, RW, DO, irq2_tim, en_bitim, bitimd );
+HD63701_Timer timer( RST, CLKx2, PERIPH_EN, ADI, RW, DO, irq2_tim, en_bitim, bitimd );
 
 
 // Built-In Devices Data Selector
@@ -87,7 +118,9 @@ HD63701_Core core
   (
    .CLKx2(CLKx2),.RST(RST),
    .NMI(NMI),.IRQ(IRQ),.IRQ2_TIM(irq2_tim),.IRQ2_SCI(irq2_sci),
-   .RW(RW),.AD(ADI),.DO(DO),.DI(biddi)
+   .RW(RW),.AD(ADI),.DO(DO),.DI(biddi),
+   .DBG_PC(DBG_PC),.DBG_D(DBG_D),.DBG_X(DBG_X),.DBG_S(DBG_S),.DBG_C(DBG_C),
+   .DBG_ICNT(DBG_ICNT),.DBG_OP(DBG_OP)
    );
   
 endmodule
@@ -217,16 +250,20 @@ module HD63701_SCI
 (
  input 	      mcu_rst,
  input 	      mcu_clx2,
+ input 	      mcu_clx2_en,
  input [15:0] mcu_ad,
  input 	      mcu_wr,
  input [7:0]  mcu_do,
 
  input 	      rx,
+ input 	      tx_slots,
  output reg   tx,
  output       te,
  output       mcu_irq2_sci,
  output       en_sci,
- output [7:0] iod
+ output [7:0] iod,
+ output [7:0] dbg_trcsr,
+ output [7:0] dbg_rmcr
 );
 
    reg [7:0]  RMCR;   // Rate and Mode Control Register
@@ -241,10 +278,21 @@ module HD63701_SCI
    reg 	      last_rx;
 
    reg [8:0]  rxsr;   // receive shift register    
-   reg [7:0]  rxcnt;  // 9 bit receive counter
+   reg [12:0] rxcnt;  // receive bit timer
    
-   reg [11:0] txcnt;  // 12 bit transmit counter
+   reg [12:0] txcnt;  // transmit bit timer
+   reg [3:0]  txslot; // bit within the 11 bit time slot
    reg [8:0]  txsr;
+
+   // The speed select bits of RMCR set the bit period to E/16,
+   // E/128, E/1024 or E/4096, i.e. 32 to 8192 cycles of CLKx2. The
+   // clock control bits are ignored, there's no external clock
+   wire [12:0] bit_last = (RMCR[1:0] == 2'b00) ? 13'd31 :
+			  (RMCR[1:0] == 2'b01) ? 13'd255 :
+			  (RMCR[1:0] == 2'b10) ? 13'd2047 :
+			  13'd8191;
+   wire [12:0] bit_mid = bit_last[12:1] + 13'd1;
+   wire        tx_bit = (txcnt >= bit_last);
    reg        clr_rd;
    reg        clr_td;
       
@@ -260,8 +308,9 @@ module HD63701_SCI
 	 clr_rd <= 1'b0;
 	 clr_td <= 1'b0;
 	 last_rx <= 1'b1;
-	 rxcnt <= 8'h00;
-	 txcnt <= 12'h000;
+	 rxcnt <= 13'd0;
+	 txcnt <= 13'd0;
+	 txslot <= 4'd0;
 	 rxsr <= 9'h1ff;
 	 txsr <= 9'h000;
 	 tx <= 1'b1;
@@ -277,17 +326,18 @@ module HD63701_SCI
 	    end
 	 end
 
-	 if(re) begin
+	 if(re && mcu_clx2_en) begin
 	 
 	    // sync rx clock on first falling data (start bit)
 	    last_rx <= rx;
-	    rxcnt <= rxcnt + 1;	 
+	    rxcnt <= (rxcnt >= bit_last) ? 13'd0 : rxcnt + 13'd1;
 	    if((rxsr == 9'h1ff) && last_rx && !rx)
-	       rxcnt <= 8'h00;	    
+	       rxcnt <= 13'd0;
 
-	    // sample serial bit in the middle of the 256 clock
-	    // cycle @ 7812.5 bit/s and shift it into rx buffer
-	    if(rxcnt == 8'd128) begin
+	    // sample serial bit in the middle of the bit period,
+	    // e.g. 256 clock cycles @ 7812.5 bit/s and shift it
+	    // into rx buffer
+	    if(rxcnt == bit_mid) begin
 	       rxsr <= { rx, rxsr[8:1] };
 	       // a full byte has been received whenever the
 	       // lowest bit would become '0' due to the start bit.
@@ -321,14 +371,17 @@ module HD63701_SCI
 	    end
 	 end
 
-	 txcnt <= txcnt + 1;
-	 if(txcnt == 12'haff) txcnt <= 12'h000;
-	 if(txcnt[7:0] == 8'hff) begin
-	    // if txsr == 0x000 then no transmission is in progress
-	    // start the transmission only at specific time slots
-	    if((txsr == 9'h000) && !TDRE && txcnt == 12'haff) begin
+	 if(mcu_clx2_en) txcnt <= tx_bit ? 13'd0 : txcnt + 13'd1;
+	 if(tx_bit && mcu_clx2_en) begin
+	    txslot <= (txslot == 4'd10) ? 4'd0 : txslot + 4'd1;
+
+	    // if txsr == 0x000 then no transmission is in progress.
+	    // The transmission starts on the next bit boundary, so
+	    // bytes go out back to back. With tx_slots it only starts
+	    // at specific time slots, 11 bit times apart
+	    if((txsr == 9'h000) && !TDRE && (!tx_slots || txslot == 4'd10)) begin
 	       TDRE <= 1'b1;
-	       txcnt <= 12'h000;        // start tx bit timer
+	       txslot <= 4'd0;        // start tx slot
 	       txsr <= { 1'b1, TDR }; // data incl stop bit
 	       tx <= 1'b0;	      // send start bit
 	       clr_td <= 1'b0;
@@ -346,6 +399,8 @@ module HD63701_SCI
    // bit 0 (wakeup) is cleared by the hardware after seeing 10 1's on RX,
    // we always return 0
    wire [7:0] TRCSR_O = { RDRF, ORFE, TDRE, TRCSR[4:1], 1'b0 };
+   assign dbg_trcsr = TRCSR_O;
+   assign dbg_rmcr = RMCR;
 
    wire       wu = TRCSR[0];   // wake up
    assign     te = TRCSR[1];   // transmitter enable
@@ -369,6 +424,7 @@ module HD63701_Timer
 (
 	input			 mcu_rst,
 	input			 mcu_clx2,
+	input			 mcu_clx2_en,
 	input [15:0] mcu_ad,
 	input 		 mcu_wr,
 	input  [7:0] mcu_do,
@@ -395,7 +451,7 @@ always @( posedge mcu_clx2 or posedge mcu_rst ) begin
 		rmc <= 8'h40;
 	end
 	else begin
-		frc <= frc+1;
+		if (mcu_clx2_en) frc <= frc+1;
 		if (mcu_wr) begin
 			case (mcu_ad)
 				16'h08: oce <= mcu_do[3];
@@ -17,7 +17,16 @@ module HD63701_Core
 	output 				RW,
 	output 	[15:0]	AD,
 	output	 [7:0]	DO,
-	input     [7:0]	DI
+	input     [7:0]	DI,
+
+	// debug: cpu state at the last instruction fetch
+	output reg [15:0]	DBG_PC,
+	output reg [15:0]	DBG_D,
+	output reg [15:0]	DBG_X,
+	output reg [15:0]	DBG_S,
+	output reg  [5:0]	DBG_C,
+	output reg [31:0]	DBG_ICNT,
+	output reg  [7:0]	DBG_OP
 );
 
 reg CLK = 0;
@@ -26,14 +35,33 @@ always @( negedge CLKx2 ) CLK <= ~CLK;
 wire `mcwidth mcode;
 wire [7:0] 	  vect;
 wire		  	  inte, fncu;
+wire			  ifetch;
+wire [15:0]		  rd, rx, rs;
+wire  [5:0]		  rc;
 
 HD63701_SEQ   SEQ(.CLK(CLK),.RST(RST),
 						.NMI(NMI),.IRQ(IRQ),.IRQ2_TIM(IRQ2_TIM),.IRQ2_SCI(IRQ2_SCI),
 						.DI(DI),
-						.mcout(mcode),.vect(vect),.inte(inte),.fncu(fncu));
+						.mcout(mcode),.vect(vect),.inte(inte),.fncu(fncu),
+						.ifetch(ifetch));
 
 HD63701_EXEC EXEC(.CLK(CLK),.RST(RST),.DI(DI),.AD(AD),.RW(RW),.DO(DO),
-						.mcode(mcode),.vect(vect),.inte(inte),.fncu(fncu));
+						.mcode(mcode),.vect(vect),.inte(inte),.fncu(fncu),
+						.dbg_d(rd),.dbg_x(rx),.dbg_s(rs),.dbg_c(rc));
+
+// latch the cpu state whenever an instruction is fetched
+always @( posedge CLK or posedge RST ) begin
+	if (RST) DBG_ICNT <= 0;
+	else if (ifetch) begin
+		DBG_PC   <= AD;
+		DBG_D    <= rd;
+		DBG_X    <= rx;
+		DBG_S    <= rs;
+		DBG_C    <= rc;
+		DBG_OP   <= DI;
+		DBG_ICNT <= DBG_ICNT+1;
+	end
+end
 
 endmodule
 
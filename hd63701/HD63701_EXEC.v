@@ -18,7 +18,13 @@ module HD63701_EXEC
 	input		`mcwidth		mcode,
 	output reg	[7:0]		vect,
 	output					inte,
-	input						fncu
+	input						fncu,
+
+	// debug: register file
+	output	  [15:0]		dbg_d,
+	output	  [15:0]		dbg_x,
+	output	  [15:0]		dbg_s,
+	output	   [5:0]		dbg_c
 );
 
 // MicroCode Format
@@ -167,6 +173,11 @@ end
 assign RW = !CLK & ((mcr2==`mcrN)|(mcr2==`mcrM)) & (~mcnw);
 
 assign inte = ~rC[4];
+
+assign dbg_d = rD;
+assign dbg_x = rX;
+assign dbg_s = rS;
+assign dbg_c = rC;
 
 endmodule
 
@@ -21,7 +21,9 @@ module HD63701_SEQ
 	output `mcwidth		mcout,
 	input		[7:0]			vect,
 	input						inte,
-	output					fncu
+	output					fncu,
+
+	output					ifetch		// debug: instruction fetch
 );
 
 `define MC_SEI {`mcSCB,   `bfI    ,`mcrC,`mcpN,`amPC,`pcN}
@@ -131,6 +133,9 @@ wire `mcwidth mcoder;
 HD63701_MCROM mcr( CLK, PHASE, (PHASE==`phEXEC) ? DI : opcode, mcoder );
 assign mcout = mcside ? mcoder : mcode;
 
+// an instruction is fetched unless an interrupt takes over
+assign ifetch = (PHASE==`phEXEC) & ~( bINT & (opcode[7:1]!=7'b0000111) );
+
 assign fncu = ( opcode[7:4]==4'h2)|
 				  ((opcode[7:4]==4'h3)&(opcode[3:0]!=4'hD));
 
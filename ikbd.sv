@@ -4,11 +4,35 @@
 // Atari ST ikbd/keyboard implementation
 //
 
-module ikbd (
+module ikbd
+  #(
+    // 0: the sci sends in 11 bit time slots like the original core
+    // and sci_tx_slots is ignored, so boards which don't connect it
+    // keep that timing. 1: sci_tx_slots selects it
+    parameter SCI_TX_SLOTS_PORT = 0,
+    // 0: everything runs at clk and periph_en is ignored, so boards
+    // which don't connect it keep running at 2MHz. 1: periph_en
+    // enables the timer, the sci and the ps2 decoder
+    parameter PERIPH_EN_PORT = 0,
+    // the ps2 keymap table, see rom/keymap.hex. The default is
+    // relative to where the tools run, like the cpu rom
+`ifdef VERILATOR
+    parameter KEYMAP = "../rom/keymap.hex"
+`else
+    parameter KEYMAP = "../ikbd/rom/keymap.hex"
+`endif
+    )
+   (
 	     // 2MHz clock (equals 4Mhz on a real 6301) and system reset
 		input 	     clk,
 		input 	     res,
 
+	     // 2MHz clock enable of the timer, the sci and the ps2
+	     // decoder. With clk at N*2MHz and periph_en set every Nth
+	     // cycle the cpu runs N times faster while the timing of the
+	     // rest stays the same. Only used with PERIPH_EN_PORT set
+		input 	     periph_en,
+
 	     // ps2 keyboard connection
 		input 	     ps2_kbd_clk,
 		input 	     ps2_kbd_data,
@@ -28,15 +52,39 @@ module ikbd (
 		// digital joystick with one fire button (FRLDU) or mouse with two buttons
 		input [4:0]  joystick1,  // regular joystick
 		input [5:0]  joystick0,  // joystick that can replace mouse
-		output 	     joy_port_toggle // signal to toggle between normal and STe joy ports
-
+		output 	     joy_port_toggle, // signal to toggle between normal and STe joy ports
+
+	     // 1: the hd6301 sci starts bytes in 11 bit time slots only
+	     // like the original core, 0: bytes go out back to back.
+	     // Only used with SCI_TX_SLOTS_PORT set
+		input 	     sci_tx_slots,
+
+	     // debug: hd6301 state at the last instruction fetch and its ports
+		output [15:0] dbg_pc,
+		output [7:0]  dbg_a,
+		output [7:0]  dbg_b,
+		output [5:0]  dbg_cc,
+		output [15:0] dbg_x,
+		output [15:0] dbg_sp,
+		output [31:0] dbg_icnt,
+		output [7:0]  dbg_opcode,
+		output [7:0]  dbg_trcsr,
+		output [7:0]  dbg_rmcr,
+		output [7:0]  dbg_po2,
+		output [7:0]  dbg_po3,
+		output [7:0]  dbg_po4,
+	     // debug: the ps2 mouse's quadrature and button lines
+		output [5:0]  dbg_mouse
 		);
 
+   wire 		     clk_en = PERIPH_EN_PORT ? periph_en : 1'b1;
    wire [7:0] 		     matrix[14:0];   
    wire [5:0] 		     mouse_atari;   
+   assign dbg_mouse = mouse_atari;
    
-   ps2 ps2 (
+   ps2 #(.KEYMAP(KEYMAP)) ps2 (
 	    .clk(clk),
+	    .clk_en(clk_en),
 	    .reset(res),
 	    
 	    .kbd_clk(ps2_kbd_clk),
@@ -88,8 +136,14 @@ module ikbd (
    // caps lock led is on P30, but isn't implemented in IKBD ROM
    assign caps_lock = po3[0];   
 
-   HD63701V0_M6 HD63701V0_M6 (
+   wire [15:0] dbg_d;
+   assign dbg_a = dbg_d[15:8];
+   assign dbg_b = dbg_d[7:0];
+   assign dbg_po2 = po2;
+
+   HD63701V0_M6 #(.SCI_TX_SLOTS_PORT(SCI_TX_SLOTS_PORT)) HD63701V0_M6 (
 			      .CLKx2(clk),
+			      .PERIPH_EN(clk_en),
 			      .RST(res),
 			      .NMI(1'b0),
 			      .IRQ(1'b0),
@@ -105,7 +159,21 @@ module ikbd (
 			      .PI2({po2[4], rx, ~fire_buttons, po2[0]}),
                               .PI4(pi4),
 			      .PO1(),
-			      .PO2(po2)
+			      .PO2(po2),
+
+			      .SCI_TX_SLOTS(sci_tx_slots),
+
+			      .DBG_PC(dbg_pc),
+			      .DBG_D(dbg_d),
+			      .DBG_X(dbg_x),
+			      .DBG_S(dbg_sp),
+			      .DBG_C(dbg_cc),
+			      .DBG_ICNT(dbg_icnt),
+			      .DBG_OP(dbg_opcode),
+			      .DBG_TRCSR(dbg_trcsr),
+			      .DBG_RMCR(dbg_rmcr),
+			      .DBG_PO3(dbg_po3),
+			      .DBG_PO4(dbg_po4)
 	      );
 
    wire [7:0] matrix_out =
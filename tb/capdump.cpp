@@ -0,0 +1,62 @@
+/*
+  capdump.cpp
+
+  Prints the edges of a pin capture as text, one per line with the
+  time in us, the pin and its new level. With -p only the given pins
+  are printed, so e.g. the tx of a field capture and its replay can
+  be compared with diff:
+
+    ./ikbd_tb -I field.cap -O replay.cap
+    diff <(./capdump -p tx field.cap) <(./capdump -p tx replay.cap)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "capture.h"
+
+static void usage(const char *name) {
+  printf("Usage: %s [-p pin]... capture\n", name);
+  printf("  -p  only print this pin, may be given multiple times:\n     ");
+  for(int i=0;i<CAP_PINS;i++)
+    printf(" %s", capture_pin_name[i]);
+  printf("\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  uint16_t mask = 0;
+
+  int c;
+  while((c = getopt(argc, argv, "p:h")) != -1) {
+    if(c != 'p') usage(argv[0]);
+
+    int i;
+    for(i=0;i<CAP_PINS && strcmp(optarg, capture_pin_name[i]);i++);
+    if(i == CAP_PINS) usage(argv[0]);
+    mask |= 1<<i;
+  }
+  if(optind != argc-1) usage(argv[0]);
+  if(!mask) mask = 0xffff;
+
+  capture_reader r;
+  if(!r.open(argv[optind])) {
+    printf("Unable to read capture %s\n", argv[optind]);
+    return 1;
+  }
+
+  uint16_t last = r.state;
+  for(int i=0;i<CAP_PINS;i++)
+    if(mask & (1<<i))
+      printf("%.2f %s %d\n", 0.0, capture_pin_name[i], (last >> i) & 1);
+
+  while(r.next()) {
+    uint16_t changed = (r.state ^ last) & mask;
+    for(int i=0;i<CAP_PINS;i++)
+      if(changed & (1<<i))
+	printf("%.2f %s %d\n", r.time/1000.0, capture_pin_name[i], (r.state >> i) & 1);
+    last = r.state;
+  }
+  return 0;
+}
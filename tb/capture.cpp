@@ -0,0 +1,134 @@
+/*
+  capture.cpp
+
+  Reading and writing pin captures, see capture.h
+*/
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "capture.h"
+
+#define HEADER_LEN  10
+
+const char *capture_pin_name[CAP_PINS] = {
+  "ps2_kbd_clk", "ps2_kbd_data", "ps2_mouse_clk", "ps2_mouse_data", "rx", "tx",
+  "joy0_up", "joy0_down", "joy0_left", "joy0_right", "joy0_fire",
+  "joy1_up", "joy1_down", "joy1_left", "joy1_right", "joy1_fire"
+};
+
+// ========= writer =========
+bool capture_writer::open(const char *file) {
+  f = fopen(file, "wb");
+  if(!f) return false;
+  setvbuf(f, NULL, _IOFBF, 1<<20);
+
+  state = CAPTURE_IDLE;
+  time = 0;
+  fwrite(CAPTURE_MAGIC, 1, 8, f);
+  fputc(state & 0xff, f);
+  fputc(state >> 8, f);
+  return true;
+}
+
+bool capture_writer::close() {
+  if(!f) return true;
+  bool ok = !ferror(f);
+  ok = !fclose(f) && ok;
+  f = NULL;
+  return ok;
+}
+
+void capture_writer::edges(uint64_t t, uint16_t s) {
+  if(!f) return;
+
+  uint64_t ticks = (t - time) / CAPTURE_TICK;
+  for(int pin=0;pin<CAP_PINS;pin++) {
+    if(!((s ^ state) & (1<<pin))) continue;
+
+    uint64_t v = ticks << 4 | pin;
+    while(v >= 0x80) {
+      putc(v | 0x80, f);
+      v >>= 7;
+    }
+    putc(v, f);
+    ticks = 0;
+  }
+  state = s;
+  time = t;
+}
+
+// ========= reader =========
+bool capture_reader::open(const char *file) {
+  int fd = ::open(file, O_RDONLY);
+  if(fd < 0) return false;
+
+  struct stat st;
+  if(fstat(fd, &st) < 0 || st.st_size < HEADER_LEN) {
+    ::close(fd);
+    return false;
+  }
+
+  size = st.st_size;
+  void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if(p == MAP_FAILED) return false;
+  data = (const uint8_t*)p;
+  madvise(p, size, MADV_SEQUENTIAL);
+
+  if(memcmp(data, CAPTURE_MAGIC, 8)) {
+    close();
+    return false;
+  }
+
+  state = data[8] | data[9] << 8;
+  time = 0;
+  pos = HEADER_LEN;
+  return true;
+}
+
+void capture_reader::close() {
+  if(data) munmap((void*)data, size);
+  data = NULL;
+}
+
+bool capture_reader::decode(size_t *p, uint64_t *ticks, int *pin) const {
+  uint64_t v = 0;
+  for(int sh=0;;sh+=7) {
+    if(*p >= size) return false;
+    uint8_t c = data[(*p)++];
+    v |= (uint64_t)(c & 0x7f) << sh;
+    if(!(c & 0x80)) break;
+  }
+  *ticks = v >> 4;
+  *pin = v & 15;
+  return true;
+}
+
+bool capture_reader::next() {
+  uint64_t ticks;
+  int pin;
+  if(!decode(&pos, &ticks, &pin)) return false;
+
+  time += ticks * CAPTURE_TICK;
+  state ^= 1<<pin;
+
+  // the other edges at this time
+  size_t p = pos;
+  while(decode(&p, &ticks, &pin) && !ticks) {
+    state ^= 1<<pin;
+    pos = p;
+  }
+  return true;
+}
+
+uint64_t capture_reader::duration() const {
+  uint64_t t = 0, ticks;
+  int pin;
+  size_t p = HEADER_LEN;
+  while(decode(&p, &ticks, &pin))
+    t += ticks * CAPTURE_TICK;
+  return t;
+}
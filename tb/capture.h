@@ -0,0 +1,107 @@
+/*
+  capture.h
+
+  Compact capture of the ikbd's serial, ps2 and joystick pins, e.g.
+  recorded on a real FPGA ikbd in the field or by the testbench's -O
+  option. The testbench replays the inputs of a capture with -I.
+
+  A capture starts with the 8 byte magic "IKBDCAP1" and the state of
+  the 16 pins at time 0 as 16 bit little endian. It is followed by
+  one varint per edge of a pin (7 bits per byte, lowest first, bit 7
+  set if more follow) holding the time since the previous edge in
+  250ns ticks shifted left by 4 and the number of the pin that
+  toggles in the low 4 bits. Edges at the same time follow with a
+  time of 0. A pin changing every few us thus takes two bytes.
+*/
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "ikbd_model.h"
+
+#define CAPTURE_MAGIC  "IKBDCAP1"
+#define CAPTURE_TICK   250     // ns
+
+// pin numbers
+#define CAP_KBD_CLK     0
+#define CAP_KBD_DATA    1
+#define CAP_MOUSE_CLK   2
+#define CAP_MOUSE_DATA  3
+#define CAP_RX          4
+#define CAP_TX          5
+#define CAP_JOY0        6      // up, down, left, right, fire
+#define CAP_JOY1       11
+#define CAP_PINS       16
+
+// everything idle, the joysticks are active high
+#define CAPTURE_IDLE   ((1<<CAP_KBD_CLK) | (1<<CAP_KBD_DATA) | (1<<CAP_MOUSE_CLK) | \
+			(1<<CAP_MOUSE_DATA) | (1<<CAP_RX) | (1<<CAP_TX))
+
+extern const char *capture_pin_name[CAP_PINS];
+
+static inline uint16_t capture_pins(const ikbd_model *m) {
+  return m->ps2_kbd_clk << CAP_KBD_CLK | m->ps2_kbd_data << CAP_KBD_DATA |
+    m->ps2_mouse_clk << CAP_MOUSE_CLK | m->ps2_mouse_data << CAP_MOUSE_DATA |
+    m->rx << CAP_RX | m->tx << CAP_TX |
+    (m->joystick0 & 0x1f) << CAP_JOY0 | (m->joystick1 & 0x1f) << CAP_JOY1;
+}
+
+// drive the model's inputs, tx is its output and left alone
+static inline void capture_apply(ikbd_model *m, uint16_t s) {
+  m->ps2_kbd_clk = (s >> CAP_KBD_CLK) & 1;
+  m->ps2_kbd_data = (s >> CAP_KBD_DATA) & 1;
+  m->ps2_mouse_clk = (s >> CAP_MOUSE_CLK) & 1;
+  m->ps2_mouse_data = (s >> CAP_MOUSE_DATA) & 1;
+  m->rx = (s >> CAP_RX) & 1;
+  m->joystick0 = (s >> CAP_JOY0) & 0x1f;
+  m->joystick1 = (s >> CAP_JOY1) & 0x1f;
+}
+
+class capture_writer {
+public:
+  capture_writer() : f(NULL), state(CAPTURE_IDLE), time(0) { }
+  ~capture_writer() { close(); }
+
+  bool open(const char *file);
+  bool close();
+
+  // the pins at time t in ns, called on every tick
+  void sample(uint64_t t, uint16_t s) {
+    if(s != state) edges(t, s);
+  }
+
+private:
+  FILE *f;
+  uint16_t state;
+  uint64_t time;
+  void edges(uint64_t t, uint16_t s);
+};
+
+// reads a capture mapped into memory, so even hours of it don't
+// need to fit into the heap
+class capture_reader {
+public:
+  capture_reader() : time(0), state(CAPTURE_IDLE), data(NULL), size(0), pos(0) { }
+  ~capture_reader() { close(); }
+
+  bool open(const char *file);
+  void close();
+
+  // advance to the next time any pin changes, false at the end
+  bool next();
+
+  // the time of the last edge, this scans the whole capture
+  uint64_t duration() const;
+
+  uint64_t time;      // in ns
+  uint16_t state;     // the pins after the edges at time
+
+private:
+  const uint8_t *data;
+  size_t size, pos;
+  bool decode(size_t *p, uint64_t *ticks, int *pin) const;
+};
+
+#endif // CAPTURE_H
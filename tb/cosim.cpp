@@ -0,0 +1,106 @@
+/*
+  cosim.cpp
+
+  Socket transport of the co-simulation link, see cosim.h
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "cosim.h"
+
+static bool address(const char *path, struct sockaddr_un *a) {
+  memset(a, 0, sizeof(*a));
+  a->sun_family = AF_UNIX;
+  if(strlen(path) >= sizeof(a->sun_path)) {
+    fprintf(stderr, "Socket path %s is too long\n", path);
+    return false;
+  }
+  strcpy(a->sun_path, path);
+  return true;
+}
+
+bool cosim_link::listen(const char *path) {
+  struct sockaddr_un a;
+  if(!address(path, &a)) return false;
+
+  int s = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(s < 0) return false;
+
+  // a socket left over from an earlier run
+  unlink(path);
+  if(bind(s, (struct sockaddr*)&a, sizeof(a)) < 0 || ::listen(s, 1) < 0) {
+    fprintf(stderr, "Unable to listen on %s: %s\n", path, strerror(errno));
+    ::close(s);
+    return false;
+  }
+
+  fd = accept(s, NULL, NULL);
+  ::close(s);
+  unlink(path);
+  return fd >= 0;
+}
+
+bool cosim_link::connect(const char *path, int timeout_ms) {
+  struct sockaddr_un a;
+  if(!address(path, &a)) return false;
+
+  // the other side may not be listening yet
+  for(int ms=0;ms<=timeout_ms;ms+=10) {
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) return false;
+    if(!::connect(fd, (struct sockaddr*)&a, sizeof(a)))
+      return true;
+    ::close(fd);
+    fd = -1;
+    usleep(10000);
+  }
+
+  fprintf(stderr, "Unable to connect to %s: %s\n", path, strerror(errno));
+  return false;
+}
+
+void cosim_link::close() {
+  if(fd >= 0) ::close(fd);
+  fd = -1;
+}
+
+void cosim_link::send(uint8_t type, uint8_t data, uint64_t time) {
+  out.push_back(type);
+  out.push_back(data);
+  for(int i=0;i<8;i++)
+    out.push_back(time >> (8*i));
+}
+
+bool cosim_link::flush() {
+  size_t done = 0;
+  while(done < out.size()) {
+    ssize_t n = write(fd, out.data() + done, out.size() - done);
+    if(n < 0 && errno == EINTR) continue;
+    if(n <= 0) return false;
+    done += n;
+  }
+  out.clear();
+  return true;
+}
+
+bool cosim_link::recv(cosim_msg *m) {
+  uint8_t b[COSIM_MSG_LEN];
+  size_t got = 0;
+  while(got < sizeof(b)) {
+    ssize_t n = read(fd, b + got, sizeof(b) - got);
+    if(n < 0 && errno == EINTR) continue;
+    if(n <= 0) return false;
+    got += n;
+  }
+
+  m->type = b[0];
+  m->data = b[1];
+  m->time = 0;
+  for(int i=7;i>=0;i--)
+    m->time = (m->time << 8) | b[2+i];
+  return true;
+}
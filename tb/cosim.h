@@ -0,0 +1,68 @@
+/*
+  cosim.h
+
+  Co-simulation link between the testbench and an emulator of the
+  ST's 6850 acia at the other end of the ikbd's rx and tx lines. The
+  two run as separate processes connected by a unix domain socket
+  and exchange the bytes on the serial lines with their time instead
+  of pin levels.
+
+  Time is synchronised conservatively in quanta. Each side simulates
+  one quantum, sends the bytes of this quantum followed by a sync
+  message and then waits for the other side's sync for the same
+  time before it starts the next one. A byte to the ikbd carries
+  the time the acia started sending it, a byte from the ikbd the
+  time its stop bit was sampled. The receiving side takes it one
+  quantum later, so it is never late however far the sender ran
+  ahead within a quantum. A quantum shorter than a byte on the line
+  (1.28ms at 7812.5 bit/s) keeps the added latency below one byte.
+
+  All messages are 10 bytes: the type, a data byte and the time in
+  ns as 64 bit little endian.
+*/
+
+#ifndef COSIM_H
+#define COSIM_H
+
+#include <stdint.h>
+#include <vector>
+
+#define COSIM_VERSION  1
+
+// message types
+#define COSIM_HELLO  1   // data: version, time: quantum in ns
+#define COSIM_BYTE   2   // data: byte, time: sent or received
+#define COSIM_SYNC   3   // sender has simulated up to time
+#define COSIM_END    4   // sender stops at time
+
+#define COSIM_MSG_LEN  10
+
+struct cosim_msg {
+  uint8_t type, data;
+  uint64_t time;
+};
+
+class cosim_link {
+public:
+  cosim_link() : fd(-1) { }
+  ~cosim_link() { close(); }
+
+  // the testbench listens and waits for a single peer to connect, the
+  // peer retries for up to timeout_ms
+  bool listen(const char *path);
+  bool connect(const char *path, int timeout_ms);
+  void close();
+
+  // messages are buffered until flush()
+  void send(uint8_t type, uint8_t data, uint64_t time);
+  bool flush();
+
+  // blocks until a message arrives, false if the peer is gone
+  bool recv(cosim_msg *m);
+
+private:
+  int fd;
+  std::vector<uint8_t> out;
+};
+
+#endif // COSIM_H
@@ -0,0 +1,98 @@
+/*
+  cosim_peer.cpp
+
+  Stand-in for an acia emulator at the other end of the testbench's
+  co-simulation link, see cosim.h. It sends bytes to the ikbd at the
+  times given on the command line like a 6850 at 7812.5 bit/s would,
+  i.e. no closer than one byte time apart, and prints what the ikbd
+  sends:
+
+    ./ikbd_tb -X /tmp/ikbd.sock scenarios/reset.scn &
+    ./cosim_peer /tmp/ikbd.sock 100:87 200:1c
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include "cosim.h"
+
+// 10 bits at 7812.5 bit/s
+#define ACIA_BYTE_NS  1280000ull
+
+struct timed_byte {
+  uint64_t time;
+  uint8_t value;
+};
+
+static void usage(const char *name) {
+  printf("Usage: %s socket [ms:byte[,byte...]]...\n", name);
+  printf("  connect to the testbench's socket and send the bytes given\n");
+  printf("  in hex to the ikbd at ms of simulation time\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  if(argc < 2) usage(argv[0]);
+
+  std::deque<timed_byte> script;
+  for(int i=2;i<argc;i++) {
+    char *end;
+    uint64_t t = strtod(argv[i], &end) * 1000000;
+    if(*end != ':') usage(argv[0]);
+    do {
+      unsigned long v = strtoul(end+1, &end, 16);
+      if(v > 0xff || (*end && *end != ',')) usage(argv[0]);
+      script.push_back( { t, (uint8_t)v } );
+    } while(*end);
+  }
+
+  cosim_link link;
+  if(!link.connect(argv[1], 5000)) return 1;
+
+  cosim_msg m;
+  if(!link.recv(&m) || m.type != COSIM_HELLO || m.data != COSIM_VERSION) {
+    printf("The testbench doesn't speak version %d\n", COSIM_VERSION);
+    return 1;
+  }
+  uint64_t quantum = m.time;
+  link.send(COSIM_HELLO, COSIM_VERSION, quantum);
+  link.flush();
+  printf("Connected, quantum %.2fus\n", quantum/1000.0);
+
+  // this side doesn't simulate anything, it follows the testbench's
+  // syncs and sends its bytes of the same quantum
+  uint64_t line_free = 0, received = 0;
+  while(link.recv(&m)) {
+    if(m.type == COSIM_BYTE) {
+      printf("@%.2fus ACIA RX %02x\n", (m.time + quantum)/1000.0, m.data);
+      received++;
+    }
+
+    if(m.type == COSIM_END) {
+      printf("@%.2fus testbench stopped, %llu bytes received\n", m.time/1000.0,
+	     (unsigned long long)received);
+      link.send(COSIM_END, 0, m.time);
+      link.flush();
+      return 0;
+    }
+
+    if(m.type == COSIM_SYNC) {
+      while(!script.empty()) {
+	uint64_t t = script.front().time;
+	if(t < line_free) t = line_free;
+	if(t >= m.time) break;
+
+	printf("@%.2fus ACIA TX %02x\n", t/1000.0, script.front().value);
+	link.send(COSIM_BYTE, script.front().value, t);
+	line_free = t + ACIA_BYTE_NS;
+	script.pop_front();
+      }
+      link.send(COSIM_SYNC, 0, m.time);
+      if(!link.flush()) break;
+    }
+  }
+
+  printf("Testbench disconnected\n");
+  return 1;
+}
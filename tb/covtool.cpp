@@ -0,0 +1,184 @@
+/*
+  covtool.cpp
+
+  Works on the rom coverage written by the testbench's -c option,
+  see rom_coverage.h.
+
+  annotate merges the coverage of all scenarios into the disassembly.
+  Each line is prefixed with the number of times it was executed or
+  ##### if never and for conditional branches T and N if they were
+  taken and not taken:
+
+         12 T- | f004	27 0a		beq  0a (F010)
+
+  minimize prints the names of the smallest set of scenarios which
+  still executes every address and takes every branch direction the
+  whole set does. This is the greedy approximation of the set cover,
+  followed by dropping scenarios whose items the others all reach.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <set>
+#include <vector>
+#include "rom_coverage.h"
+
+static void usage(const char *name) {
+  printf("Usage: %s annotate asm_file coverage...\n", name);
+  printf("       %s minimize coverage...\n", name);
+  exit(1);
+}
+
+static const char *branch_marks(const rom_coverage &c, int s) {
+  static const char *marks[4] = { "--", "-N", "T-", "TN" };
+  return marks[(c.taken[s]?2:0) | (c.not_taken[s]?1:0)];
+}
+
+static int annotate(const char *asm_file, const rom_coverage &c) {
+  FILE *f = fopen(asm_file, "r");
+  if(!f) {
+    printf("Unable to open %s\n", asm_file);
+    return 1;
+  }
+
+  int insns = 0, executed = 0, dirs = 0, dirs_taken = 0;
+  char line[256];
+  while(fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\r\n")] = 0;
+
+    unsigned addr, op;
+    char sep;
+    int s = -1;
+    if(sscanf(line, "%4x%c%2x", &addr, &sep, &op) == 3 && (sep == '\t' || sep == ' '))
+      s = rom_coverage::slot(addr);
+
+    if(s < 0) {
+      printf("%9s %2s | %s\n", "", "", line);
+      continue;
+    }
+
+    insns++;
+    if(c.hits[s]) executed++;
+
+    bool br = COV_IS_BRANCH(op);
+    if(br) {
+      dirs += 2;
+      dirs_taken += (c.taken[s]?1:0) + (c.not_taken[s]?1:0);
+    }
+
+    char count[24];
+    if(c.hits[s]) sprintf(count, "%llu", (unsigned long long)c.hits[s]);
+    else          strcpy(count, "#####");
+    printf("%9s %2s | %s\n", count, br?branch_marks(c, s):"", line);
+  }
+  fclose(f);
+
+  // code downloaded into the ram isn't part of the disassembly
+  bool header = false;
+  for(int s=4096;s<COV_SLOTS;s++) {
+    if(!c.hits[s]) continue;
+    if(!header) printf("%9s %2s | ;code downloaded into the ram\n", "", "");
+    header = true;
+    printf("%9llu %2s | %04x\n", (unsigned long long)c.hits[s],
+	   c.branch[s]?branch_marks(c, s):"", rom_coverage::address(s));
+  }
+
+  fprintf(stderr, "%s: %d of %d instructions executed (%.1f%%), %d of %d branch directions taken (%.1f%%)\n",
+	  c.name.c_str(), executed, insns, insns?100.0*executed/insns:0,
+	  dirs_taken, dirs, dirs?100.0*dirs_taken/dirs:0);
+  return 0;
+}
+
+// everything a scenario reaches: the addresses and the directions
+// of the branches
+static std::set<int> items(const rom_coverage &c) {
+  std::set<int> r;
+  for(int s=0;s<COV_SLOTS;s++) {
+    if(c.hits[s])      r.insert(3*s);
+    if(c.taken[s])     r.insert(3*s+1);
+    if(c.not_taken[s]) r.insert(3*s+2);
+  }
+  return r;
+}
+
+static int minimize(const std::vector<rom_coverage*> &cov) {
+  std::vector<std::set<int> > it;
+  std::set<int> all;
+  for(size_t i=0;i<cov.size();i++) {
+    it.push_back(items(*cov[i]));
+    all.insert(it[i].begin(), it[i].end());
+  }
+
+  // take the scenario reaching the most items not reached yet until
+  // all are
+  std::vector<bool> chosen(cov.size(), false);
+  std::vector<size_t> order;
+  std::set<int> reached;
+  while(reached.size() < all.size()) {
+    size_t best = 0, best_new = 0;
+    for(size_t i=0;i<cov.size();i++) {
+      if(chosen[i]) continue;
+      size_t n = 0;
+      for(int x : it[i])
+	if(!reached.count(x)) n++;
+      if(n > best_new) {
+	best = i;
+	best_new = n;
+      }
+    }
+    chosen[best] = true;
+    order.push_back(best);
+    reached.insert(it[best].begin(), it[best].end());
+  }
+
+  // an early pick may be covered by the later ones together
+  for(size_t k=order.size();k-->0;) {
+    size_t i = order[k];
+    chosen[i] = false;
+    std::set<int> r;
+    for(size_t j=0;j<cov.size();j++)
+      if(chosen[j]) r.insert(it[j].begin(), it[j].end());
+    if(r.size() < all.size()) chosen[i] = true;
+  }
+
+  int n = 0;
+  for(size_t i=0;i<cov.size();i++) {
+    if(!chosen[i]) continue;
+    printf("%s\n", cov[i]->name.c_str());
+    n++;
+  }
+
+  fprintf(stderr, "%d of %d scenarios reach the same %d addresses and branch directions\n",
+	  n, (int)cov.size(), (int)all.size());
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if(argc < 3) usage(argv[0]);
+
+  bool ann = !strcmp(argv[1], "annotate");
+  if(!ann && strcmp(argv[1], "minimize")) usage(argv[0]);
+  int first = ann?3:2;
+  if(argc <= first) usage(argv[0]);
+
+  std::vector<rom_coverage*> cov;
+  rom_coverage *total = new rom_coverage;
+  total->name = "total";
+  for(int i=first;i<argc;i++) {
+    rom_coverage *c = new rom_coverage;
+    if(!c->read(argv[i]) || !total->read(argv[i])) {
+      printf("Unable to read coverage %s\n", argv[i]);
+      return 1;
+    }
+    if(c->name.empty()) c->name = argv[i];
+    cov.push_back(c);
+  }
+
+  int r = ann?annotate(argv[2], *total):minimize(cov);
+
+  for(size_t i=0;i<cov.size();i++)
+    delete cov[i];
+  delete total;
+  return r;
+}
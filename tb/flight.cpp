@@ -0,0 +1,182 @@
+/*
+  flight.cpp
+
+  Flight recorder, see flight.h
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "flight.h"
+
+// a new block starts after this many bytes of records
+#define BLOCK_SIZE  4096
+
+// the signals in the packed state
+static const struct {
+  const char *name;
+  int shift, width;
+} signals[] = {
+  { "tx",             0,  1 },
+  { "rx",             1,  1 },
+  { "ps2_kbd_clk",    2,  1 },
+  { "ps2_kbd_data",   3,  1 },
+  { "ps2_mouse_clk",  4,  1 },
+  { "ps2_mouse_data", 5,  1 },
+  { "po2",            8,  8 },
+  { "po3",           16,  8 },
+  { "po4",           24,  8 },
+  { "trcsr",         32,  8 },
+  { "rmcr",          40,  8 },
+  { "pc",            48, 16 }
+};
+
+#define SIGNALS  (int)(sizeof(signals)/sizeof(signals[0]))
+
+static inline uint32_t value(int i, uint64_t s) {
+  return (s >> signals[i].shift) & ((1ull << signals[i].width) - 1);
+}
+
+bool flight_recorder::trigger_add(const std::string &pred) {
+  size_t eq = pred.find('=');
+  if(eq == std::string::npos) return false;
+
+  for(int i=0;i<SIGNALS;i++) {
+    if(pred.compare(0, eq, signals[i].name)) continue;
+
+    char *end;
+    unsigned long v = strtoul(pred.c_str() + eq + 1, &end, 16);
+    if(*end || end == pred.c_str() + eq + 1 || v >= (1ul << signals[i].width))
+      return false;
+    triggers.push_back( { i, (uint32_t)v, pred } );
+    return true;
+  }
+  return false;
+}
+
+const char *flight_recorder::record(uint64_t t, uint64_t s) {
+  uint64_t changed = s ^ last;
+  const char *reason = NULL;
+
+  // the pc is only valid once the cpu fetched from the rom, code
+  // loaded by the host runs in the internal ram at $80-$ff
+  if(changed >> 48) {
+    uint16_t pc = s >> 48;
+    if(pc >= 0xf000)
+      pc_valid = true;
+    else if(pc_valid && (pc < 0x80 || pc > 0xff))
+      reason = "pc outside rom and ram";
+  }
+
+  for(size_t i=0;i<triggers.size();i++) {
+    const trigger &tr = triggers[i];
+    if(value(tr.sig, s) == tr.value && value(tr.sig, last) != tr.value)
+      reason = tr.text.c_str();
+  }
+
+  // start a new block when the current one is full and drop those
+  // completely out of the window
+  if(blocks.empty() || blocks.back().data.size() >= BLOCK_SIZE) {
+    while(blocks.size() > 1 && blocks[1].time + window <= t)
+      blocks.pop_front();
+    blocks.push_back( { t, last, std::vector<uint8_t>() } );
+    blocks.back().data.reserve(BLOCK_SIZE + 16);
+    last_time = t;
+  }
+
+  std::vector<uint8_t> &d = blocks.back().data;
+  uint64_t dt = (t - last_time) / 250;
+  while(dt >= 0x80) {
+    d.push_back(dt | 0x80);
+    dt >>= 7;
+  }
+  d.push_back(dt);
+
+  uint8_t mask = 0;
+  for(int i=0;i<8;i++)
+    if((changed >> 8*i) & 0xff) mask |= 1<<i;
+  d.push_back(mask);
+  for(int i=0;i<8;i++)
+    if(mask & (1<<i)) d.push_back(s >> 8*i);
+
+  last = s;
+  last_time = t;
+  return reason;
+}
+
+// ========= VCD output =========
+static void vcd_value(FILE *f, int i, uint32_t v) {
+  if(signals[i].width == 1) {
+    fprintf(f, "%u%c\n", v, '!' + i);
+    return;
+  }
+  fputc('b', f);
+  for(int b=signals[i].width-1;b>=0;b--)
+    fputc((v >> b) & 1?'1':'0', f);
+  fprintf(f, " %c\n", '!' + i);
+}
+
+static void vcd_dumpvars(FILE *f, uint64_t t, uint64_t s) {
+  fprintf(f, "#%llu\n$dumpvars\n", (unsigned long long)t);
+  for(int i=0;i<SIGNALS;i++)
+    vcd_value(f, i, value(i, s));
+  fprintf(f, "$end\n");
+}
+
+bool flight_recorder::write(const char *file, uint64_t t) const {
+  FILE *f = fopen(file, "w");
+  if(!f) return false;
+
+  fprintf(f, "$version ikbd testbench flight recorder $end\n");
+  fprintf(f, "$timescale 1ns $end\n");
+  fprintf(f, "$scope module ikbd $end\n");
+  for(int i=0;i<SIGNALS;i++)
+    fprintf(f, "$var wire %d %c %s $end\n", signals[i].width, '!' + i, signals[i].name);
+  fprintf(f, "$upscope $end\n$enddefinitions $end\n");
+
+  // the state at the start of the window is written in full, then
+  // the changes after it
+  uint64_t from = t > window?t - window:0;
+  uint64_t shown = 0, state = blocks.empty()?last:blocks.front().state;
+  bool started = false;
+
+  for(size_t b=0;b<blocks.size();b++) {
+    const std::vector<uint8_t> &d = blocks[b].data;
+    uint64_t time = blocks[b].time;
+
+    for(size_t p=0;p<d.size();) {
+      uint64_t dt = 0;
+      for(int sh=0;;sh+=7) {
+	uint8_t c = d[p++];
+	dt |= (uint64_t)(c & 0x7f) << sh;
+	if(!(c & 0x80)) break;
+      }
+      time += dt * 250;
+
+      uint8_t mask = d[p++];
+      uint64_t next = state;
+      for(int i=0;i<8;i++) {
+	if(!(mask & (1<<i))) continue;
+	next = (next & ~(0xffull << 8*i)) | (uint64_t)d[p++] << 8*i;
+      }
+
+      if(time >= from && !started) {
+	shown = time == from?next:state;
+	vcd_dumpvars(f, from, shown);
+	started = true;
+      }
+      if(time > from) {
+	fprintf(f, "#%llu\n", (unsigned long long)time);
+	for(int i=0;i<SIGNALS;i++)
+	  if(value(i, next) != value(i, shown))
+	    vcd_value(f, i, value(i, next));
+	shown = next;
+      }
+      state = next;
+    }
+  }
+
+  if(!started)
+    vcd_dumpvars(f, from, state);
+  fprintf(f, "#%llu\n", (unsigned long long)t);
+  return !fclose(f);
+}
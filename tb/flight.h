@@ -0,0 +1,75 @@
+/*
+  flight.h
+
+  Flight recorder which keeps the last milliseconds of the ikbd's
+  serial, ps2 and port pins, the sci registers and the pc in memory
+  and writes them as a VCD file only when something went wrong. It
+  works on the pins of ikbd_model, so unlike the verilator trace it
+  runs with every model and costs little more than an untraced run.
+
+  All signals are packed into one 64 bit word which is compared on
+  every tick. Only changes are stored: the ticks since the previous
+  change, a mask of the bytes that changed and these bytes. The
+  records are kept in blocks which each start with the full state,
+  so the oldest block can be dropped once it is out of the window.
+*/
+
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include <stdint.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include "ikbd_model.h"
+
+class flight_recorder {
+public:
+  flight_recorder(uint64_t window_ns) : window(window_ns), last(0), last_time(0), pc_valid(false) { }
+
+  // user trigger "signal=value" with the value in hex, false if the
+  // signal is unknown
+  bool trigger_add(const std::string &pred);
+
+  // record the model's pins at time t, returns the reason if this
+  // sample fired a trigger
+  const char *sample(uint64_t t, const ikbd_model *m) {
+    uint64_t s = pack(m);
+    if(s == last) return NULL;
+    return record(t, s);
+  }
+
+  // write the window up to time t
+  bool write(const char *file, uint64_t t) const;
+
+  uint64_t window;
+
+private:
+  static uint64_t pack(const ikbd_model *m) {
+    return (uint64_t)m->tx | m->rx << 1 |
+      m->ps2_kbd_clk << 2 | m->ps2_kbd_data << 3 |
+      m->ps2_mouse_clk << 4 | m->ps2_mouse_data << 5 |
+      (uint64_t)m->dbg_po2 << 8 | (uint64_t)m->dbg_po3 << 16 |
+      (uint64_t)m->dbg_po4 << 24 | (uint64_t)m->dbg_trcsr << 32 |
+      (uint64_t)m->dbg_rmcr << 40 | (uint64_t)m->dbg_pc << 48;
+  }
+
+  struct block {
+    uint64_t time, state;     // when it starts and the state then
+    std::vector<uint8_t> data;
+  };
+  std::deque<block> blocks;
+  uint64_t last, last_time;
+
+  struct trigger {
+    int sig;
+    uint32_t value;
+    std::string text;
+  };
+  std::vector<trigger> triggers;
+  bool pc_valid;
+
+  const char *record(uint64_t t, uint64_t s);
+};
+
+#endif // FLIGHT_H
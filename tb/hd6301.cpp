@@ -0,0 +1,682 @@
+/*
+  hd6301.cpp
+
+  Instruction level HD6301V1 model, see hd6301.h
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "hd6301.h"
+
+// condition code bits
+#define CC_C  0x01
+#define CC_V  0x02
+#define CC_Z  0x04
+#define CC_N  0x08
+#define CC_I  0x10
+#define CC_H  0x20
+
+#define SET(f,c)  cc = (c)?(cc|(f)):(cc&~(f))
+
+// HD6301V1 datasheet instruction timing in E cycles
+const uint8_t hd6301::cycles[256] = {
+  /*      0  1  2  3  4  5  6  7  8  9  a  b  c  d  e  f */
+  /* 0 */ 0, 1, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  /* 1 */ 1, 1, 0, 0, 0, 0, 1, 1, 2, 2, 4, 1, 0, 0, 0, 0,
+  /* 2 */ 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+  /* 3 */ 1, 1, 3, 3, 1, 1, 4, 4, 4, 5, 1,10, 5, 7, 9,12,
+  /* 4 */ 1, 0, 0, 1, 1, 0, 1, 1, 1, 1, 1, 0, 1, 1, 0, 1,
+  /* 5 */ 1, 0, 0, 1, 1, 0, 1, 1, 1, 1, 1, 0, 1, 1, 0, 1,
+  /* 6 */ 6, 7, 7, 6, 6, 7, 6, 6, 6, 6, 6, 5, 6, 4, 3, 5,
+  /* 7 */ 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 4, 6, 4, 3, 5,
+  /* 8 */ 2, 2, 2, 3, 2, 2, 2, 0, 2, 2, 2, 2, 3, 5, 3, 0,
+  /* 9 */ 3, 3, 3, 4, 3, 3, 3, 3, 3, 3, 3, 3, 4, 5, 4, 4,
+  /* a */ 4, 4, 4, 5, 4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5,
+  /* b */ 4, 4, 4, 5, 4, 4, 4, 4, 4, 4, 4, 4, 5, 6, 5, 5,
+  /* c */ 2, 2, 2, 3, 2, 2, 2, 0, 2, 2, 2, 2, 3, 0, 3, 0,
+  /* d */ 3, 3, 3, 4, 3, 3, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4,
+  /* e */ 4, 4, 4, 5, 4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5,
+  /* f */ 4, 4, 4, 5, 4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5
+};
+
+hd6301::hd6301() {
+  memset(rom, 0xff, sizeof(rom));
+  memset(ram, 0, sizeof(ram));
+  pi1 = 0xff; pi2 = 0x1f; pi4 = 0xff;
+  tx_slots = false;
+  track = false;
+  clear_track();
+  reset();
+}
+
+bool hd6301::load_rom(const char *name) {
+  FILE *f = fopen(name, "r");
+  if(!f) {
+    fprintf(stderr, "Unable to open rom %s\n", name);
+    return false;
+  }
+
+  // same format $readmemh uses for MCU_BIROM
+  unsigned int v, n = 0;
+  while(n < sizeof(rom) && fscanf(f, "%x", &v) == 1)
+    rom[n++] = v;
+
+  fclose(f);
+  return n == sizeof(rom);
+}
+
+void hd6301::reset() {
+  ddr1 = ddr2 = ddr3 = ddr4 = 0;
+  por1 = por2 = por3 = por4 = 0;
+  // operating mode is latched from P20-P22
+  mode = pi2 & 7;
+
+  frc = 0; ocr = 0xffff; icr = 0xffff;
+  frt = 0; rmc = 0x40;
+  oci = oce = false;
+
+  rmcr = trcsr = rdr = tdr = 0;
+  tdre = true; rdrf = orfe = false;
+  clr_rd = clr_td = false;
+  tdr_next = 0; tdr_delay = 0;
+  last_rx = true; txd = true;
+  rxsr = 0x1ff; txsr = 0;
+  rxcnt = 0; txcnt = 0; txslot = 0;
+
+  a = b = 0; x = 0; sp = 0;
+  cc = CC_I;
+  sleeping = wai_pushed = false;
+  phase = false;
+  busy = 0;
+  icnt = 0;
+  iop = 0;
+
+  pc = read16(0xfffe);
+  ipc = pc; ia = a; ib = b; ix = x; isp = sp; icc = cc;
+}
+
+uint8_t hd6301::po2() const {
+  uint8_t p = (mode << 5) | ((~ddr2 | por2) & 0x1f);
+
+  // sci tx replaces P24 if the transmitter is enabled
+  if(trcsr & 0x02)
+    p = (p & ~0x10) | (txd?0x10:0x00);
+
+  return p;
+}
+
+uint8_t hd6301::read(uint16_t addr) {
+  if(addr >= 0xf000) return rom[addr & 0xfff];
+  if(addr >= 0x0080 && addr < 0x0100) {
+    if(track) {
+      uint64_t m = 1ull << (addr & 0x3f);
+      int i = (addr >> 6) & 1;
+      if(!(ram_wr[i] & m)) ram_rd[i] |= m;
+    }
+    return ram[addr & 0x7f];
+  }
+  if(addr >= 0x08 && addr <= 0x14) touched |= TOUCH_IO;
+
+  switch(addr) {
+  case 0x00: return ddr1;
+  case 0x01: return 0xe0 | ddr2;
+  case 0x02: return pi1;
+  case 0x03: return 0xe0 | pi2;
+  case 0x04: return ddr3;
+  case 0x05: return ddr4;
+  case 0x06: return 0x00;     // PI3 is not connected
+  case 0x07: return pi4;
+
+  case 0x08: return (oci?0x40:0x00) | 0x20 | (oce?0x08:0x00);
+  case 0x09: return frc >> 9;
+  case 0x0a: return frc >> 1;
+  case 0x0b: oci = false; return ocr >> 8;
+  case 0x0c: oci = false; return ocr;
+  case 0x0d: return icr >> 8;
+  case 0x0e: return icr;
+
+  case 0x10: return rmcr;
+  case 0x11:
+    clr_rd = clr_td = true;
+    // wakeup bit always reads 0
+    return trcsr_o();
+  case 0x12:
+    if(clr_rd) {
+      rdrf = orfe = false;
+      clr_rd = false;
+    }
+    return rdr;
+  case 0x13: return tdr;
+
+  case 0x14: return rmc;
+  }
+
+  // unused addresses read the unconnected external bus
+  return 0x00;
+}
+
+void hd6301::write(uint16_t addr, uint8_t data) {
+  if(addr >= 0x0080 && addr < 0x0100) {
+    if(track) ram_wr[(addr >> 6) & 1] |= 1ull << (addr & 0x3f);
+    ram[addr & 0x7f] = data;
+    return;
+  }
+  if(addr >= 0x08 && addr <= 0x14) touched |= TOUCH_IO;
+
+  switch(addr) {
+  case 0x00: ddr1 = data; break;
+  case 0x01: ddr2 = data & 0x1f; break;
+  case 0x02: por1 = data; break;
+  case 0x03: por2 = data & 0x1f; break;
+  case 0x04: ddr3 = data; break;
+  case 0x05: ddr4 = data; break;
+  case 0x06: por3 = data; break;
+  case 0x07: por4 = data; break;
+
+  case 0x08: oce = (data & 0x08) != 0; break;
+  case 0x09: frt = data; break;
+  case 0x0a: frc = (frt << 9) | (data << 1); break;
+  case 0x0b: ocr = (ocr & 0x00ff) | (data << 8); oci = false; break;
+  case 0x0c: ocr = (ocr & 0xff00) | data; oci = false; break;
+  case 0x0d: icr = (icr & 0x00ff) | (data << 8); break;
+  case 0x0e: icr = (icr & 0xff00) | data; break;
+
+  case 0x10: rmcr = data; break;
+  case 0x11: trcsr = data; break;
+  case 0x13:
+    // the verilog core writes a direct or indexed store on the E
+    // cycle after the fetch and an extended one on the second. The
+    // sci then starts the byte on the same bit boundary
+    tdr_next = data;
+    tdr_delay = ((iop & 0xf0) == 0xb0 || (iop & 0xf0) == 0xf0)?2:1;
+    break;
+
+  case 0x14: rmc = data & 0xc0; break;
+  }
+}
+
+void hd6301::tdr_write() {
+  if(clr_td) {
+    tdre = false;
+    clr_td = false;
+  }
+  tdr = tdr_next;
+}
+
+// the sci is modelled bit by bit after HD63701_SCI
+void hd6301::sci_clock() {
+  bool rx = (pi2 & 0x08) != 0;
+
+  // E/16, E/128, E/1024 or E/4096, the clock control bits of RMCR
+  // are ignored like in the verilog
+  uint16_t last = bit_period() - 1;
+
+  if(trcsr & 0x08) {
+    bool start = (rxsr == 0x1ff) && last_rx && !rx;
+    uint16_t cnt = rxcnt;
+
+    last_rx = rx;
+    rxcnt = (start || rxcnt >= last)?0:rxcnt+1;
+
+    // sample in the middle of the bit period
+    if(cnt == last/2 + 1) {
+      uint16_t sr = rxsr;
+      rxsr = (rx?0x100:0) | (rxsr >> 1);
+      if(!(sr & 1)) {
+	if(rx) {
+	  rxsr = 0x1ff;
+	  if(rdrf) orfe = true;   // overrun, data is lost
+	  else     rdr = sr >> 1;
+	  rdrf = true;
+	  clr_rd = false;
+	} else {
+	  // framing error, data is transferred anyway
+	  orfe = true;
+	  rdr = sr >> 1;
+	}
+      }
+    }
+  }
+
+  if(txcnt < last)
+    txcnt++;
+  else {
+    uint8_t slot = txslot;
+    txcnt = 0;
+    txslot = (txslot == 10)?0:txslot+1;
+
+    // transmission starts on the next bit boundary or only at
+    // fixed time slots
+    if(!txsr && !tdre && (!tx_slots || slot == 10)) {
+      tdre = true;
+      txslot = 0;
+      txsr = 0x100 | tdr;
+      txd = false;
+      clr_td = false;
+    } else if(txsr) {
+      txd = txsr & 1;
+      txsr >>= 1;
+    }
+  }
+}
+
+// the counter only advances with the clock enable but like in the
+// verilog core the compare runs on every cycle
+void hd6301::timer_clock(bool periph_en) {
+  if(periph_en)
+    frc = (frc + 1) & 0x1ffff;
+  if((frc >> 1) == ocr)
+    oci = true;
+}
+
+bool hd6301::irq_pending(uint16_t *vector) {
+  if(cc & CC_I) return false;
+
+  if(oci && oce) {
+    *vector = 0xfff4;
+    return true;
+  }
+
+  bool rie = trcsr & 0x10, tie = trcsr & 0x04;
+  if((rie && (rdrf || orfe)) || (tie && tdre)) {
+    *vector = 0xfff0;
+    return true;
+  }
+
+  return false;
+}
+
+void hd6301::interrupt(uint16_t vector) {
+  touched |= TOUCH_INTR;
+  if(!wai_pushed) {
+    push16(pc);
+    push16(x);
+    push(a);
+    push(b);
+    push(cc);
+  }
+  wai_pushed = false;
+  sleeping = false;
+  cc |= CC_I;
+  pc = read16(vector);
+}
+
+void hd6301::clock(bool periph_en) {
+  timer_clock(periph_en);
+  if(periph_en)
+    sci_clock();
+
+  // the cpu runs on E which is CLKx2/2
+  phase = !phase;
+  if(!phase) return;
+
+  if(tdr_delay && !--tdr_delay)
+    tdr_write();
+
+  if(busy) {
+    busy--;
+    return;
+  }
+
+  // interrupts are checked between instructions but not right
+  // after cli/sei
+  uint16_t vector;
+  if(((iop & 0xfe) != 0x0e || sleeping) && irq_pending(&vector)) {
+    interrupt(vector);
+    iop = 0;
+    busy = INTR_CYCLES - 1;
+    return;
+  }
+
+  if(sleeping)
+    return;
+
+  step();
+}
+
+void hd6301::nz8(uint8_t r) {
+  SET(CC_N, r & 0x80);
+  SET(CC_Z, !r);
+}
+
+void hd6301::nz16(uint16_t r) {
+  SET(CC_N, r & 0x8000);
+  SET(CC_Z, !r);
+}
+
+uint8_t hd6301::add8(uint8_t a, uint8_t b, int c) {
+  unsigned int r = a + b + c;
+  SET(CC_H, (a ^ b ^ r) & 0x10);
+  SET(CC_V, (a ^ r) & (b ^ r) & 0x80);
+  SET(CC_C, r & 0x100);
+  nz8(r);
+  return r;
+}
+
+uint8_t hd6301::sub8(uint8_t a, uint8_t b, int c) {
+  unsigned int r = a - b - c;
+  SET(CC_V, (a ^ b) & (a ^ r) & 0x80);
+  SET(CC_C, r & 0x100);
+  nz8(r);
+  return r;
+}
+
+uint16_t hd6301::add16(uint16_t a, uint16_t b) {
+  uint32_t r = a + b;
+  SET(CC_V, (a ^ r) & (b ^ r) & 0x8000);
+  SET(CC_C, r & 0x10000);
+  nz16(r);
+  return r;
+}
+
+uint16_t hd6301::sub16(uint16_t a, uint16_t b) {
+  uint32_t r = a - b;
+  SET(CC_V, (a ^ b) & (a ^ r) & 0x8000);
+  SET(CC_C, r & 0x10000);
+  nz16(r);
+  return r;
+}
+
+// read-modify-write ops share the low nibble of their opcodes
+uint8_t hd6301::rmw(uint8_t op, uint8_t v) {
+  uint8_t r = v;
+  int c;
+
+  switch(op & 0x0f) {
+  case 0x0:  // NEG
+    r = -v;
+    SET(CC_V, r == 0x80);
+    SET(CC_C, r != 0);
+    break;
+  case 0x3:  // COM
+    r = ~v;
+    cc = (cc & ~CC_V) | CC_C;
+    break;
+  case 0x4:  // LSR
+    r = v >> 1;
+    SET(CC_C, v & 1);
+    break;
+  case 0x6:  // ROR
+    r = (v >> 1) | ((cc & CC_C)?0x80:0);
+    SET(CC_C, v & 1);
+    break;
+  case 0x7:  // ASR
+    r = (v >> 1) | (v & 0x80);
+    SET(CC_C, v & 1);
+    break;
+  case 0x8:  // ASL
+    r = v << 1;
+    SET(CC_C, v & 0x80);
+    break;
+  case 0x9:  // ROL
+    c = cc & CC_C;
+    r = (v << 1) | c;
+    SET(CC_C, v & 0x80);
+    break;
+  case 0xa:  // DEC
+    r = v - 1;
+    SET(CC_V, v == 0x80);
+    break;
+  case 0xc:  // INC
+    r = v + 1;
+    SET(CC_V, v == 0x7f);
+    break;
+  case 0xd:  // TST
+    cc &= ~(CC_V|CC_C);
+    break;
+  case 0xf:  // CLR
+    r = 0;
+    cc &= ~(CC_V|CC_C);
+    break;
+  }
+
+  nz8(r);
+
+  // shifts set V from N^C
+  if((op & 0x0f) == 0x4 || ((op & 0x0f) >= 0x6 && (op & 0x0f) <= 0x9))
+    SET(CC_V, ((cc & CC_N)?1:0) ^ ((cc & CC_C)?1:0));
+
+  return r;
+}
+
+bool hd6301::branch(uint8_t op) {
+  bool c = cc & CC_C, v = cc & CC_V, z = cc & CC_Z, n = cc & CC_N;
+
+  switch(op & 0x0f) {
+  case 0x0: return true;          // BRA
+  case 0x1: return false;         // BRN
+  case 0x2: return !(c || z);     // BHI
+  case 0x3: return c || z;        // BLS
+  case 0x4: return !c;            // BCC
+  case 0x5: return c;             // BCS
+  case 0x6: return !z;            // BNE
+  case 0x7: return z;             // BEQ
+  case 0x8: return !v;            // BVC
+  case 0x9: return v;             // BVS
+  case 0xa: return !n;            // BPL
+  case 0xb: return n;             // BMI
+  case 0xc: return n == v;        // BGE
+  case 0xd: return n != v;        // BLT
+  case 0xe: return !z && n == v;  // BGT
+  }
+  return z || n != v;             // BLE
+}
+
+void hd6301::step() {
+  // remember state at the instruction boundary
+  ipc = pc; ia = a; ib = b; ix = x; isp = sp; icc = cc;
+  icnt++;
+
+  uint8_t op = fetch();
+  iop = op;
+  busy = cycles[op] - 1;
+
+  uint16_t ea = 0, d = (a << 8) | b, w;
+  uint8_t v;
+
+  // effective address of the memory operand
+  switch(op & 0xf0) {
+  case 0x60: case 0xa0: case 0xe0:
+    if(op == 0x61 || op == 0x62 || op == 0x65 || op == 0x6b) break;
+    ea = x + fetch();
+    break;
+  case 0x70: case 0xb0: case 0xf0:
+    if(op == 0x71 || op == 0x72 || op == 0x75 || op == 0x7b) break;
+    ea = fetch16();
+    break;
+  case 0x90: case 0xd0:
+    ea = fetch();
+    break;
+  }
+
+  switch(op) {
+  case 0x01: break;                                              // NOP
+  case 0x04: SET(CC_C, d & 1); d >>= 1; goto set_d_shift;        // LSRD
+  case 0x05: SET(CC_C, d & 0x8000); d <<= 1;                     // ASLD
+  set_d_shift:
+    nz16(d);
+    SET(CC_V, ((cc & CC_N)?1:0) ^ ((cc & CC_C)?1:0));
+    a = d >> 8; b = d;
+    break;
+  case 0x06: cc = a & 0x3f; break;                               // TAP
+  case 0x07: a = cc | 0xc0; break;                               // TPA
+  case 0x08: x++; SET(CC_Z, !x); break;                          // INX
+  case 0x09: x--; SET(CC_Z, !x); break;                          // DEX
+  case 0x0a: cc &= ~CC_V; break;                                 // CLV
+  case 0x0b: cc |= CC_V; break;                                  // SEV
+  case 0x0c: cc &= ~CC_C; break;                                 // CLC
+  case 0x0d: cc |= CC_C; break;                                  // SEC
+  case 0x0e: cc &= ~CC_I; break;                                 // CLI
+  case 0x0f: cc |= CC_I; break;                                  // SEI
+
+  case 0x10: a = sub8(a, b, 0); break;                           // SBA
+  case 0x11: sub8(a, b, 0); break;                               // CBA
+  case 0x16: b = a; nz8(b); cc &= ~CC_V; break;                  // TAB
+  case 0x17: a = b; nz8(a); cc &= ~CC_V; break;                  // TBA
+  case 0x18: w = x; x = d; a = w >> 8; b = w; break;             // XGDX
+  case 0x19: {                                                   // DAA
+    unsigned int t = a, cf = 0;
+    if((cc & CC_H) || (t & 0x0f) > 9) cf |= 0x06;
+    if((cc & CC_C) || t > 0x99 || (t > 0x8f && (t & 0x0f) > 9)) cf |= 0x60;
+    t += cf;
+    if(t & 0x100) cc |= CC_C;
+    a = t;
+    nz8(a);
+    cc &= ~CC_V;
+  } break;
+  case 0x1a: sleeping = true; break;                             // SLP
+  case 0x1b: a = add8(a, b, 0); break;                           // ABA
+
+  case 0x20: case 0x21: case 0x22: case 0x23:                    // Bcc
+  case 0x24: case 0x25: case 0x26: case 0x27:
+  case 0x28: case 0x29: case 0x2a: case 0x2b:
+  case 0x2c: case 0x2d: case 0x2e: case 0x2f:
+    v = fetch();
+    if(branch(op)) pc += (int8_t)v;
+    break;
+
+  case 0x30: x = sp + 1; break;                                  // TSX
+  case 0x31: sp++; break;                                        // INS
+  case 0x32: a = pull(); break;                                  // PULA
+  case 0x33: b = pull(); break;                                  // PULB
+  case 0x34: sp--; break;                                        // DES
+  case 0x35: sp = x - 1; break;                                  // TXS
+  case 0x36: push(a); break;                                     // PSHA
+  case 0x37: push(b); break;                                     // PSHB
+  case 0x38: x = pull16(); break;                                // PULX
+  case 0x39: pc = pull16(); break;                               // RTS
+  case 0x3a: x += b; break;                                      // ABX
+  case 0x3b:                                                     // RTI
+    cc = pull() & 0x3f; b = pull(); a = pull();
+    x = pull16(); pc = pull16();
+    break;
+  case 0x3c: push(x); push(x >> 8); break;                       // PSHX
+  case 0x3d:                                                     // MUL
+    d = a * b; a = d >> 8; b = d;
+    SET(CC_C, b & 0x80);
+    break;
+  case 0x3e:                                                     // WAI
+    push16(pc); push16(x); push(a); push(b); push(cc);
+    sleeping = wai_pushed = true;
+    break;
+  case 0x3f:                                                     // SWI
+    interrupt(0xfffa);
+    break;
+
+  case 0x40: case 0x43: case 0x44: case 0x46: case 0x47:         // A ops
+  case 0x48: case 0x49: case 0x4a: case 0x4c: case 0x4d: case 0x4f:
+    v = rmw(op, a);
+    if(op != 0x4d) a = v;
+    break;
+  case 0x50: case 0x53: case 0x54: case 0x56: case 0x57:         // B ops
+  case 0x58: case 0x59: case 0x5a: case 0x5c: case 0x5d: case 0x5f:
+    v = rmw(op, b);
+    if(op != 0x5d) b = v;
+    break;
+
+  case 0x61: case 0x62: case 0x65: case 0x6b:                    // xIM #,X
+  case 0x71: case 0x72: case 0x75: case 0x7b: {                  // xIM #,dir
+    uint8_t imm = fetch();
+    ea = (op & 0x10)?fetch():(x + fetch());
+    v = read(ea);
+    switch(op & 0x0f) {
+    case 0x1: v &= imm; break;
+    case 0x2: v |= imm; break;
+    case 0x5: v ^= imm; break;
+    case 0xb: v &= imm; break;
+    }
+    nz8(v);
+    cc &= ~CC_V;
+    if((op & 0x0f) != 0xb) write(ea, v);
+  } break;
+
+  case 0x6e: case 0x7e: pc = ea; break;                          // JMP
+
+  case 0x60: case 0x63: case 0x64: case 0x66: case 0x67:         // memory ops
+  case 0x68: case 0x69: case 0x6a: case 0x6c: case 0x6d: case 0x6f:
+  case 0x70: case 0x73: case 0x74: case 0x76: case 0x77:
+  case 0x78: case 0x79: case 0x7a: case 0x7c: case 0x7d: case 0x7f:
+    v = rmw(op, ((op & 0x0f) == 0x0f)?0:read(ea));
+    if((op & 0x0f) != 0x0d) write(ea, v);
+    break;
+
+  case 0x8d:                                                     // BSR
+    v = fetch();
+    push16(pc);
+    pc += (int8_t)v;
+    break;
+  case 0x9d: case 0xad: case 0xbd:                               // JSR
+    push16(pc);
+    pc = ea;
+    break;
+
+  case 0x83: case 0x93: case 0xa3: case 0xb3:                    // SUBD
+  case 0xc3: case 0xd3: case 0xe3: case 0xf3:                    // ADDD
+    w = ((op & 0xf0) == 0x80 || (op & 0xf0) == 0xc0)?fetch16():read16(ea);
+    d = (op & 0x40)?add16(d, w):sub16(d, w);
+    a = d >> 8; b = d;
+    break;
+  case 0x8c: case 0x9c: case 0xac: case 0xbc:                    // CPX
+    sub16(x, (op == 0x8c)?fetch16():read16(ea));
+    break;
+  case 0x8e: case 0x9e: case 0xae: case 0xbe:                    // LDS
+    sp = (op == 0x8e)?fetch16():read16(ea);
+    nz16(sp); cc &= ~CC_V;
+    break;
+  case 0x9f: case 0xaf: case 0xbf:                               // STS
+    write16(ea, sp);
+    nz16(sp); cc &= ~CC_V;
+    break;
+  case 0xcc: case 0xdc: case 0xec: case 0xfc:                    // LDD
+    d = (op == 0xcc)?fetch16():read16(ea);
+    a = d >> 8; b = d;
+    nz16(d); cc &= ~CC_V;
+    break;
+  case 0xdd: case 0xed: case 0xfd:                               // STD
+    write16(ea, d);
+    nz16(d); cc &= ~CC_V;
+    break;
+  case 0xce: case 0xde: case 0xee: case 0xfe:                    // LDX
+    x = (op == 0xce)?fetch16():read16(ea);
+    nz16(x); cc &= ~CC_V;
+    break;
+  case 0xdf: case 0xef: case 0xff:                               // STX
+    write16(ea, x);
+    nz16(x); cc &= ~CC_V;
+    break;
+
+  case 0x97: case 0xa7: case 0xb7:                               // STAA
+    write(ea, a); nz8(a); cc &= ~CC_V;
+    break;
+  case 0xd7: case 0xe7: case 0xf7:                               // STAB
+    write(ea, b); nz8(b); cc &= ~CC_V;
+    break;
+
+  default:
+    // remaining 8 bit accumulator ops with the usual layout
+    if(op >= 0x80 && cycles[op]) {
+      uint8_t *r = (op & 0x40)?&b:&a;
+      uint8_t m = ((op & 0x30) == 0x00)?fetch():read(ea);
+
+      switch(op & 0x0f) {
+      case 0x0: *r = sub8(*r, m, 0); break;                      // SUB
+      case 0x1: sub8(*r, m, 0); break;                           // CMP
+      case 0x2: *r = sub8(*r, m, cc & CC_C); break;              // SBC
+      case 0x4: *r &= m; nz8(*r); cc &= ~CC_V; break;            // AND
+      case 0x5: nz8(*r & m); cc &= ~CC_V; break;                 // BIT
+      case 0x6: *r = m; nz8(*r); cc &= ~CC_V; break;             // LDA
+      case 0x8: *r ^= m; nz8(*r); cc &= ~CC_V; break;            // EOR
+      case 0x9: *r = add8(*r, m, cc & CC_C); break;              // ADC
+      case 0xa: *r |= m; nz8(*r); cc &= ~CC_V; break;            // ORA
+      case 0xb: *r = add8(*r, m, 0); break;                      // ADD
+      }
+      break;
+    }
+
+    // undefined opcode
+    pc--;
+    interrupt(0xffee);
+    busy = INTR_CYCLES - 1;
+    break;
+  }
+}
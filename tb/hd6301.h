@@ -0,0 +1,160 @@
+/*
+  hd6301.h
+
+  Instruction level model of the HD6301V1 as used in the Atari ST
+  ikbd. It implements the cpu core as well as the on-chip RAM, the
+  i/o ports, the SCI and the timer the way hd63701/HD63701.v does.
+
+  The model is clocked with the same 2MHz CLKx2 the verilog core
+  runs on. Like there the timer and the sci only advance on the
+  cycles their clock enable is set, so CLKx2 may be faster while
+  their timing stays the same. Instructions are executed in one go
+  on their first E cycle and the cpu then idles for the remaining
+  cycles the HD6301 datasheet specifies for the instruction. Only
+  TDR writes are held back to the cycle the verilog core does them.
+*/
+
+#ifndef HD6301_H
+#define HD6301_H
+
+#include <stdint.h>
+#include "verilated_save.h"
+
+// interrupt and trap entry incl. stacking of all registers
+#define INTR_CYCLES  12
+
+// what the cpu did since the last clear_track(), see track
+#define TOUCH_IO    0x01   // accessed the timer, the sci or RAM control
+#define TOUCH_INTR  0x02   // took an interrupt, swi or trap
+
+class hd6301 {
+public:
+  hd6301();
+
+  // load the 4k internal rom from a hexdump like rom/ikbd.hex
+  bool load_rom(const char *name);
+
+  void reset();
+  // one rising edge of CLKx2, periph_en enables the timer and the sci
+  void clock(bool periph_en = true);
+
+  // the whole state is plain data and is saved as such
+  void save(VerilatedSerialize &os) { os.write(this, sizeof(*this)); }
+  void restore(VerilatedDeserialize &os) { os.read(this, sizeof(*this)); }
+
+  // port inputs (PI2 is 5 bits wide)
+  uint8_t pi1, pi2, pi4;
+
+  // start sci transmissions only in 11 bit time slots, see
+  // SCI_TX_SLOTS of HD63701V0_M6
+  bool tx_slots;
+
+  // TRCSR as read by the cpu
+  uint8_t trcsr_o() const {
+    return (rdrf?0x80:0) | (orfe?0x40:0) | (tdre?0x20:0) | (trcsr & 0x1e); }
+
+  // port outputs, unused bits read as 1 like in HD63701_IOPort
+  uint8_t po1() const { return ~ddr1 | por1; }
+  uint8_t po2() const;
+  uint8_t po3() const { return ~ddr3 | por3; }
+  uint8_t po4() const { return ~ddr4 | por4; }
+
+  // cpu registers
+  uint8_t a, b, cc;
+  uint16_t x, sp, pc;
+
+  // state at the begin of the last instruction. This is what the
+  // verilog core exports on its debug ports
+  uint16_t ipc;
+  uint8_t ia, ib, icc;
+  uint16_t ix, isp;
+  uint8_t iop;
+  uint32_t icnt;
+
+  // number of cycles (E) the current instruction still occupies
+  int busy;
+
+  // HD6301 datasheet cycle counts, 0 for undefined opcodes
+  static const uint8_t cycles[256];
+
+  uint8_t rom[4096];
+  uint8_t ram[128];
+
+  // i/o ports
+  uint8_t ddr1, ddr2, ddr3, ddr4;
+  uint8_t por1, por2, por3, por4;
+  uint8_t mode;
+
+  // timer
+  uint32_t frc;        // 17 bits like the verilog, LSB toggles with CLKx2
+  uint16_t ocr, icr;
+  uint8_t frt, rmc;
+  bool oci, oce;
+
+  // sci
+  uint8_t rmcr, trcsr, rdr, tdr;
+  bool rdrf, tdre, orfe;
+  bool clr_rd, clr_td;
+  uint8_t tdr_next;        // TDR write held back for tdr_delay E cycles
+  int tdr_delay;
+  bool last_rx, txd;
+  uint16_t rxsr, txsr;
+  uint16_t rxcnt, txcnt;   // bit timers
+  uint8_t txslot;          // bit within the 11 bit time slot
+
+  // bit period in CLKx2 cycles from the speed select bits of RMCR,
+  // i.e. E/16, E/128, E/1024 and E/4096
+  uint16_t bit_period() const {
+    static const uint16_t period[4] = { 32, 256, 2048, 8192 };
+    return period[rmcr & 3];
+  }
+
+  // cpu state
+  bool sleeping;       // SLP or WAI executed
+  bool wai_pushed;     // WAI already stacked the registers
+  bool phase;          // E cycle divider
+
+  // with track set the ram bytes read before being written and
+  // those written are recorded in bitmaps. The fast forward of
+  // ikbd_sim uses this to tell what a main loop iteration depends
+  // on and what it changes
+  bool track;
+  uint64_t ram_rd[2], ram_wr[2];
+  uint8_t touched;
+  void clear_track() {
+    ram_rd[0] = ram_rd[1] = ram_wr[0] = ram_wr[1] = 0;
+    touched = 0;
+  }
+
+  uint8_t read(uint16_t addr);
+  void write(uint16_t addr, uint8_t data);
+
+private:
+  void sci_clock();
+  void tdr_write();
+  void timer_clock(bool periph_en);
+  void step();
+  void interrupt(uint16_t vector);
+  bool irq_pending(uint16_t *vector);
+
+  uint8_t fetch() { return read(pc++); }
+  uint16_t fetch16() { uint16_t v = fetch() << 8; return v | fetch(); }
+  uint16_t read16(uint16_t addr) { return (read(addr) << 8) | read(addr+1); }
+  void write16(uint16_t addr, uint16_t v) { write(addr, v>>8); write(addr+1, v); }
+  void push(uint8_t v) { write(sp--, v); }
+  void push16(uint16_t v) { push(v); push(v>>8); }
+  uint8_t pull() { return read(++sp); }
+  uint16_t pull16() { uint16_t v = pull() << 8; return v | pull(); }
+
+  // flag helpers
+  void nz8(uint8_t r);
+  void nz16(uint16_t r);
+  uint8_t add8(uint8_t a, uint8_t b, int c);
+  uint8_t sub8(uint8_t a, uint8_t b, int c);
+  uint16_t add16(uint16_t a, uint16_t b);
+  uint16_t sub16(uint16_t a, uint16_t b);
+  uint8_t rmw(uint8_t op, uint8_t v);
+  bool branch(uint8_t op);
+};
+
+#endif // HD6301_H
@@ -0,0 +1,292 @@
+/*
+  ikbd_cycles.cpp
+
+  Checks the number of E cycles every HD6301 opcode takes against
+  the datasheet timing in hd6301::cycles. The rom's delay loops, the
+  mouse polling and the TDRE waits depend on it, so changes to the
+  microcode of the core must not alter it.
+
+  Each opcode is downloaded into the ram with the $20 memory load
+  command behind a short setup and run with $22 execute, just like a
+  game's loader would. The instruction's cycles are the E cycles
+  between its fetch and the next one as seen on the debug ports:
+
+    00b0  0f        sei
+    00b1  4f        clra
+    00b2  c6 c0     ldab #c0
+    00b4  18        xgdx           ; indexed operands point to $c1
+    00b5  xx ..     the opcode and its operands
+    00b8  01        nop            ; skipped by branches
+    00b9  20 fe     bra  00b9
+
+  The memory load drops bytes of $00 (ff08), so the code avoids them:
+  branches skip a nop instead of branching by 0 and the extended
+  operands are $c0c0 outside of the ram which reads and writes with
+  the same timing. For the same reason opcode $00 isn't checked.
+  The rom also takes the first byte after a memory load as part of
+  the last command, so the execute follows a $13 like in the
+  Froggies loader.
+
+  Undefined opcodes trap and swi take INTR_CYCLES, the interrupt
+  entry is checked separately as well: the timer's OCF interrupt is enabled
+  while the cpu loops in a bra and the time until the fetch at the
+  handler is the bra plus INTR_CYCLES. wai and slp stop the cpu until
+  an interrupt and aren't checked.
+
+  The model boots once and a child process is forked for every
+  opcode like in ikbd_fuzz. A mismatch makes the exit code 1:
+
+    ./ikbd_cycles -m rtl
+
+  The C++ model takes its cycles from hd6301::cycles as well, so
+  -m sim only checks the download and the measurement themselves.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <vector>
+#include "ikbd_rtl.h"
+#include "ikbd_sim.h"
+#include "hd6301.h"
+#include "uart.h"
+
+// the download is sent after the rom has booted
+#define INPUT_MS  80
+
+// the instruction under test and the data it works on
+#define CODE_ADDR  0xb0
+#define TEST_ADDR  0xb5
+#define DATA_ADDR  0xc0
+#define EXT_ADDR   0xc0c0
+
+// the rom's OCF interrupt handler
+#define OCF_HANDLER  0xfd9d
+
+// a child exits with this if the instruction was never reached
+#define TIMEOUT_MS  100
+#define NO_RESULT   255
+
+static const char *mnemonic[256] = {
+  /*        0       1       2       3       4       5       6       7
+	    8       9       a       b       c       d       e       f */
+  /* 0 */ "-",    "nop",  "-",    "-",    "lsrd", "asld", "tap",  "tpa",
+	  "inx",  "dex",  "clv",  "sev",  "clc",  "sec",  "cli",  "sei",
+  /* 1 */ "sba",  "cba",  "-",    "-",    "-",    "-",    "tab",  "tba",
+	  "xgdx", "daa",  "slp",  "aba",  "-",    "-",    "-",    "-",
+  /* 2 */ "bra",  "brn",  "bhi",  "bls",  "bcc",  "bcs",  "bne",  "beq",
+	  "bvc",  "bvs",  "bpl",  "bmi",  "bge",  "blt",  "bgt",  "ble",
+  /* 3 */ "tsx",  "ins",  "pula", "pulb", "des",  "txs",  "psha", "pshb",
+	  "pulx", "rts",  "abx",  "rti",  "pshx", "mul",  "wai",  "swi",
+  /* 4 */ "nega", "-",    "-",    "coma", "lsra", "-",    "rora", "asra",
+	  "asla", "rola", "deca", "-",    "inca", "tsta", "-",    "clra",
+  /* 5 */ "negb", "-",    "-",    "comb", "lsrb", "-",    "rorb", "asrb",
+	  "aslb", "rolb", "decb", "-",    "incb", "tstb", "-",    "clrb",
+  /* 6 */ "neg",  "aim",  "oim",  "com",  "lsr",  "eim",  "ror",  "asr",
+	  "asl",  "rol",  "dec",  "tim",  "inc",  "tst",  "jmp",  "clr",
+  /* 7 */ "neg",  "aim",  "oim",  "com",  "lsr",  "eim",  "ror",  "asr",
+	  "asl",  "rol",  "dec",  "tim",  "inc",  "tst",  "jmp",  "clr",
+  /* 8 */ "suba", "cmpa", "sbca", "subd", "anda", "bita", "ldaa", "-",
+	  "eora", "adca", "oraa", "adda", "cpx",  "bsr",  "lds",  "-",
+  /* 9 */ "suba", "cmpa", "sbca", "subd", "anda", "bita", "ldaa", "staa",
+	  "eora", "adca", "oraa", "adda", "cpx",  "jsr",  "lds",  "sts",
+  /* a */ "suba", "cmpa", "sbca", "subd", "anda", "bita", "ldaa", "staa",
+	  "eora", "adca", "oraa", "adda", "cpx",  "jsr",  "lds",  "sts",
+  /* b */ "suba", "cmpa", "sbca", "subd", "anda", "bita", "ldaa", "staa",
+	  "eora", "adca", "oraa", "adda", "cpx",  "jsr",  "lds",  "sts",
+  /* c */ "subb", "cmpb", "sbcb", "addd", "andb", "bitb", "ldab", "-",
+	  "eorb", "adcb", "orab", "addb", "ldd",  "-",    "ldx",  "-",
+  /* d */ "subb", "cmpb", "sbcb", "addd", "andb", "bitb", "ldab", "stab",
+	  "eorb", "adcb", "orab", "addb", "ldd",  "std",  "ldx",  "stx",
+  /* e */ "subb", "cmpb", "sbcb", "addd", "andb", "bitb", "ldab", "stab",
+	  "eorb", "adcb", "orab", "addb", "ldd",  "std",  "ldx",  "stx",
+  /* f */ "subb", "cmpb", "sbcb", "addd", "andb", "bitb", "ldab", "stab",
+	  "eorb", "adcb", "orab", "addb", "ldd",  "std",  "ldx",  "stx"
+};
+
+// addressing mode and the operand bytes following the opcode,
+// none of them 0
+static const char *operands(uint8_t op, std::vector<uint8_t> &v) {
+  if(!hd6301::cycles[op]) return "trap";
+
+  switch(op & 0xf0) {
+  case 0x20:
+    v.push_back(0x01);
+    return "rel";
+  case 0x60:
+    // aim, oim, eim and tim take an immediate byte first
+    if(op == 0x61 || op == 0x62 || op == 0x65 || op == 0x6b) v.push_back(0xff);
+    v.push_back(0x01);
+    return "idx";
+  case 0x70:
+    if(op == 0x71 || op == 0x72 || op == 0x75 || op == 0x7b) {
+      v.push_back(0xff);
+      v.push_back(DATA_ADDR);
+      return "dir";
+    }
+    v.push_back(EXT_ADDR >> 8);
+    v.push_back(EXT_ADDR & 0xff);
+    return "ext";
+  case 0x80: case 0xc0:
+    if(op == 0x8d) {
+      v.push_back(0x01);
+      return "rel";
+    }
+    // subd, addd, cpx, ldd, lds and ldx take a word
+    if((op & 0x0f) == 0x3 || (op & 0x0f) >= 0xc) v.push_back(DATA_ADDR);
+    v.push_back(DATA_ADDR);
+    return "imm";
+  case 0x90: case 0xd0:
+    v.push_back(DATA_ADDR);
+    return "dir";
+  case 0xa0: case 0xe0:
+    v.push_back(0x01);
+    return "idx";
+  case 0xb0: case 0xf0:
+    v.push_back(EXT_ADDR >> 8);
+    v.push_back(EXT_ADDR & 0xff);
+    return "ext";
+  }
+  return "inh";
+}
+
+static uint64_t tickcount;
+
+// the clock rises every 500ns like in the testbench
+static int tick(ikbd_model *m) {
+  int c = (tickcount / 250) & 1?0:1;
+  m->clk = c;
+  m->eval();
+  tickcount += 250;
+  return c;
+}
+
+// power up and run until the download is due
+static void boot(ikbd_model *m) {
+  m->res = 1;
+  while(tickcount < 2500)
+    tick(m);
+  m->res = 0;
+
+  while(tickcount < INPUT_MS * 1000000ull)
+    tick(m);
+}
+
+// download and execute the code, then return the E cycles from the
+// fetch at addr to the next one. With intr the next fetch must be
+// the one at the OCF handler
+static int measure(ikbd_model *m, const std::vector<uint8_t> &code, uint16_t addr, bool intr) {
+  std::vector<uint8_t> in = { 0x20, 0x00, CODE_ADDR, (uint8_t)code.size() };
+  in.insert(in.end(), code.begin(), code.end());
+  in.insert(in.end(), { 0x13, 0x22, 0x00, CODE_ADDR });
+
+  uart_tx uart;
+  uart.send(in.data(), in.size());
+
+  uint64_t st = tickcount, tpb = 0, fetch = 0;
+  uint64_t timeout = 0;
+  uint32_t icnt = m->dbg_icnt;
+
+  for(;;) {
+    if(uart.busy() && tickcount >= st) {
+      if(uart.start_bit()) tpb = sci_tpb(m->dbg_rmcr);
+      size_t done;
+      m->rx = uart.next(&done);
+      st = tickcount + tpb;
+      if(!uart.busy()) timeout = st + TIMEOUT_MS * 1000000ull;
+    }
+
+    if(!tick(m)) continue;
+    if(timeout && tickcount >= timeout) return NO_RESULT;
+    if(m->dbg_icnt == icnt) continue;
+    icnt = m->dbg_icnt;
+
+    if(fetch && (!intr || m->dbg_pc == OCF_HANDLER))
+      return (tickcount - fetch) / 1000;
+    fetch = 0;
+    if(m->dbg_pc == addr) fetch = tickcount;
+  }
+}
+
+// run measure() in a child of the booted model
+static int fork_measure(ikbd_model *m, const std::vector<uint8_t> &code, uint16_t addr, bool intr) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if(pid == 0)
+    _exit(measure(m, code, addr, intr));
+
+  int status;
+  if(waitpid(pid, &status, 0) != pid || !WIFEXITED(status))
+    return NO_RESULT;
+  return WEXITSTATUS(status);
+}
+
+static bool report(const char *op, const char *name, const char *mode, int expected, int measured) {
+  bool ok = measured == expected;
+  printf("%-4s %-5s %-5s %5d ", op, name, mode, expected);
+  if(measured == NO_RESULT) printf("%8s", "-");
+  else                      printf("%8d", measured);
+  printf("%s\n", ok?"":"  MISMATCH");
+  return ok;
+}
+
+static void usage(const char *name) {
+  printf("Usage: %s [-m rtl|sim]\n", name);
+  printf("  -m  model to check, the verilated rtl (default) or the C++ model\n");
+  printf("      which only checks the harness, it uses the datasheet table\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *model = "rtl";
+
+  int c;
+  while((c = getopt(argc, argv, "m:h")) != -1) {
+    if(c != 'm') usage(argv[0]);
+    model = optarg;
+  }
+  if(optind != argc || (strcmp(model, "sim") && strcmp(model, "rtl")))
+    usage(argv[0]);
+
+  ikbd_model *m;
+  if(!strcmp(model, "sim")) m = new ikbd_sim;
+  else                      m = new ikbd_rtl;
+  boot(m);
+
+  printf("%s model, E cycles per instruction\n", m->name());
+  printf("op   insn  mode  datasheet measured\n");
+
+  int checked = 0, failed = 0;
+  for(int op=0;op<256;op++) {
+    // slp and wai stop the cpu until an interrupt, $00 can't be
+    // downloaded
+    if(op == 0x1a || op == 0x3e || op == 0x00) continue;
+
+    std::vector<uint8_t> code = { 0x0f, 0x4f, 0xc6, DATA_ADDR, 0x18, (uint8_t)op };
+    const char *mode = operands(op, code);
+    code.insert(code.end(), { 0x01, 0x20, 0xfe });
+
+    int expected = hd6301::cycles[op]?hd6301::cycles[op]:INTR_CYCLES;
+    char hex[8];
+    sprintf(hex, "%02x", op);
+    if(!report(hex, mnemonic[op], mode, expected, fork_measure(m, code, TEST_ADDR, false)))
+      failed++;
+    checked++;
+  }
+
+  // enable the OCF interrupt like the rom does and wait in a bra
+  // with interrupts enabled. The first bra completes before the
+  // interrupt is taken
+  std::vector<uint8_t> code = { 0x0f, 0x72, 0x08, 0x08, 0x0e, 0x20, 0xfe };
+  int measured = fork_measure(m, code, CODE_ADDR + 5, true);
+  if(measured != NO_RESULT) measured -= hd6301::cycles[0x20];
+  if(!report("-", "intr", "ocf", INTR_CYCLES, measured))
+    failed++;
+  checked++;
+
+  printf("%d instructions checked, %d mismatches\n", checked, failed);
+  delete m;
+  return failed?1:0;
+}
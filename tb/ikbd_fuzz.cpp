@@ -0,0 +1,462 @@
+/*
+  ikbd_fuzz.cpp
+
+  Coverage guided fuzzer for the command parser of the ikbd rom. The
+  model boots once and a child process is forked from the booted
+  state for every input, so each one starts from the same state at
+  the cost of a fork. Before the fork the sci is switched to 62500
+  bit/s by a memory load to RMCR, so the input takes an eighth of the
+  time on the line. The child sends the input to the ikbd's rx
+  like the testbench's uart and records the rom coverage, see
+  rom_coverage.h, into memory shared with the parent. Inputs which
+  reach new addresses or branch directions join the corpus and are
+  mutated further. Several children run in parallel.
+
+  Two kinds of failures are kept:
+  - crash: the pc left the rom and the internal ram, unless it was
+	   in code the $22 execute command jumped to
+  - hang:  neither a byte on tx nor a pass through the main loop at
+	   f13a/f150 for HANG_MS
+  Crashes are told apart by the last valid pc before, hangs by new
+  coverage. Every input kept is written as a scenario which
+  reproduces it in the testbench, e.g. with the flight recorder:
+
+    ./ikbd_fuzz -o fuzz scenarios/froggies.scn scenarios/dragonnels.scn
+    ./ikbd_tb -F 50 -o fuzz fuzz/crash_0000.scn
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "ikbd_rtl.h"
+#include "ikbd_sim.h"
+#include "rom_coverage.h"
+#include "scenario.h"
+#include "uart.h"
+
+// the rate is set at this time, after the rom has booted. It is
+// after the testbench's snapshot, so the scenarios written work
+// with -R as well
+#define RATE_MS  80
+
+// the input is sent at this time, at 62500 bit/s
+#define INPUT_MS  100
+
+// time to wait for the reply after the input was sent
+#define SETTLE_MS  5
+
+// longer than the 80ms the memory load waits for each byte
+#define HANG_MS  200
+
+#define MAX_LEN  32
+
+#define MAIN_LOOP1  0xf13a
+#define MAIN_LOOP2  0xf150
+
+// jsr 00,x of the $22 execute command and its return address
+#define EXECUTE_JSR  0xfc4d
+#define EXECUTE_RET  0xfc4f
+
+#define COV_ITEMS  (3*COV_SLOTS)
+
+// ========= one run of the model =========
+#define RES_OK     0
+#define RES_CRASH  1
+#define RES_HANG   2
+
+// the result a child leaves in the shared memory
+struct result {
+  int status;
+  uint16_t last_pc;       // the last valid pc of a crash
+  uint64_t time;          // simulated
+  uint8_t items[COV_ITEMS/8];
+};
+
+static uint64_t now_us() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000000ull + tv.tv_usec;
+}
+
+static uint64_t tickcount;
+
+// the clock rises every 500ns like in the testbench
+static int tick(ikbd_model *m) {
+  int c = (tickcount / 250) & 1?0:1;
+  m->clk = c;
+  m->eval();
+  tickcount += 250;
+  return c;
+}
+
+// drives rx like the testbench's uart, the bit time follows the
+// rate the ikbd's sci is set to
+struct rx_line {
+  rx_line() : st(0), tpb(0), sent(0) { }
+  uart_tx uart;
+  uint64_t st, tpb;
+  uint64_t sent;          // end of the last stop bit
+
+  void send(const uint8_t *data, size_t len) {
+    if(!uart.busy()) st = tickcount;
+    uart.send(data, len);
+    sent = 0;
+  }
+
+  void run(ikbd_model *m) {
+    if(!uart.busy() || tickcount < st) return;
+    if(uart.start_bit()) tpb = sci_tpb(m->dbg_rmcr);
+    size_t done;
+    m->rx = uart.next(&done);
+    st = tickcount + tpb;
+    if(!uart.busy()) sent = st;
+  }
+};
+
+// RMCR to $04 by a memory load to its address $0010. The rom leaves
+// its input counter at 1 after it, the next byte only resets it. See
+// scenarios/download_62500.scn
+static const uint8_t rate_load[] = { 0x20, 0x00, 0x10, 0x01, 0x04 };
+static const uint8_t rate_reset[] = { 0x00 };
+
+// power up, set the rate and run until the input is due
+static void boot(ikbd_model *m) {
+  rx_line rx;
+  m->res = 1;
+  while(tickcount < 2500)
+    tick(m);
+  m->res = 0;
+
+  while(tickcount < INPUT_MS * 1000000ull) {
+    if(tickcount == RATE_MS * 1000000ull)
+      rx.send(rate_load, sizeof(rate_load));
+    if(tickcount == (RATE_MS + 10) * 1000000ull)
+      rx.send(rate_reset, sizeof(rate_reset));
+    rx.run(m);
+    tick(m);
+  }
+}
+
+static void execute(ikbd_model *m, const std::vector<uint8_t> &in, result *r) {
+  rom_coverage *cov = new rom_coverage;
+  rx_line rx;
+  rx.send(in.data(), in.size());
+
+  uint64_t active = tickcount;
+  uint16_t last_pc = m->dbg_pc;
+  bool executing = false;
+  r->status = RES_OK;
+
+  for(;;) {
+    rx.run(m);
+    if(!tick(m)) continue;
+
+    cov->sample(m);
+    uint16_t pc = m->dbg_pc;
+    // the host may jump anywhere with $22, what happens after that
+    // isn't the rom's fault
+    if(pc == EXECUTE_JSR) executing = true;
+    if(pc == EXECUTE_RET) executing = false;
+    if(rom_coverage::slot(pc) < 0) {
+      if(!executing) {
+	r->status = RES_CRASH;
+	r->last_pc = last_pc;
+      }
+      break;
+    }
+    last_pc = pc;
+
+    if(pc == MAIN_LOOP1 || pc == MAIN_LOOP2 || !m->tx)
+      active = tickcount;
+
+    if(tickcount - active >= HANG_MS * 1000000ull) {
+      r->status = RES_HANG;
+      break;
+    }
+    if(rx.sent && tickcount >= rx.sent + SETTLE_MS * 1000000ull && tickcount - active < 1000000)
+      break;
+  }
+
+  r->time = tickcount - INPUT_MS * 1000000ull;
+  memset(r->items, 0, sizeof(r->items));
+  for(int s=0;s<COV_SLOTS;s++) {
+    if(cov->hits[s])      r->items[(3*s) >> 3]   |= 1 << ((3*s) & 7);
+    if(cov->taken[s])     r->items[(3*s+1) >> 3] |= 1 << ((3*s+1) & 7);
+    if(cov->not_taken[s]) r->items[(3*s+2) >> 3] |= 1 << ((3*s+2) & 7);
+  }
+  delete cov;
+}
+
+// ========= mutation =========
+static uint32_t seed = 1;
+
+static uint32_t rnd(uint32_t n) {
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed % n;
+}
+
+// valid commands with typical parameters
+static const std::vector<std::vector<uint8_t> > dictionary = {
+  { 0x80, 0x01 }, { 0x07, 0x00 }, { 0x08 }, { 0x09, 0x01, 0x40, 0x00, 0xc8 },
+  { 0x0a, 0x01, 0x01 }, { 0x0b, 0x01, 0x01 }, { 0x0c, 0x01, 0x01 }, { 0x0d },
+  { 0x0e, 0x00, 0x00, 0x10, 0x00, 0x10 }, { 0x0f }, { 0x10 }, { 0x11 }, { 0x12 },
+  { 0x13 }, { 0x14 }, { 0x15 }, { 0x16 }, { 0x17, 0x0a }, { 0x18 },
+  { 0x19, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01 }, { 0x1a },
+  { 0x1b, 0x87, 0x10, 0x17, 0x12, 0x34, 0x56 }, { 0x1c },
+  { 0x20, 0x00, 0x90, 0x01, 0x39 }, { 0x21, 0xf0, 0x00 }, { 0x22, 0xf0, 0x10 },
+  { 0x87 }, { 0x88 }, { 0x89 }, { 0x8a }, { 0x8b }, { 0x8c }, { 0x8f }, { 0x90 }, { 0x92 },
+  { 0x94 }, { 0x95 }, { 0x99 }, { 0x9a }
+};
+
+static const uint8_t interesting[] = { 0x00, 0x01, 0x7f, 0x80, 0x81, 0xfe, 0xff };
+
+static std::vector<uint8_t> mutate(const std::vector<std::vector<uint8_t> > &corpus, size_t i) {
+  std::vector<uint8_t> v = corpus[i];
+
+  for(int n=1+rnd(4);n>0;n--) {
+    size_t pos = v.empty()?0:rnd(v.size());
+    switch(rnd(8)) {
+    case 0:
+      if(!v.empty()) v[pos] ^= 1 << rnd(8);
+      break;
+    case 1:
+      if(!v.empty()) v[pos] = rnd(256);
+      break;
+    case 2:
+      if(!v.empty()) v[pos] = interesting[rnd(sizeof(interesting))];
+      break;
+    case 3:
+      v.insert(v.begin() + pos, rnd(256));
+      break;
+    case 4:
+      if(v.size() > 1) v.erase(v.begin() + pos);
+      break;
+    case 5: {
+      size_t len = 1 + rnd(4);
+      if(pos + len <= v.size())
+	v.insert(v.begin() + pos, v.begin() + pos, v.begin() + pos + len);
+    } break;
+    case 6: {
+      const std::vector<uint8_t> &d = dictionary[rnd(dictionary.size())];
+      v.insert(v.begin() + (v.empty()?0:rnd(v.size()+1)), d.begin(), d.end());
+    } break;
+    case 7: {
+      // splice with the tail of another input
+      const std::vector<uint8_t> &o = corpus[rnd(corpus.size())];
+      if(!o.empty()) {
+	v.resize(pos);
+	v.insert(v.end(), o.begin() + rnd(o.size()), o.end());
+      }
+    } break;
+    }
+  }
+
+  if(v.empty()) v.push_back(rnd(256));
+  if(v.size() > MAX_LEN) v.resize(MAX_LEN);
+  return v;
+}
+
+// ========= output =========
+static bool write_scenario(const std::string &file, const std::vector<uint8_t> &in,
+			   const char *what) {
+  FILE *f = fopen(file.c_str(), "w");
+  if(!f) {
+    printf("Unable to write %s\n", file.c_str());
+    return false;
+  }
+
+  // the bytes take 1.28ms each if a reset sets the rate back to
+  // 7812.5 bit/s
+  int runtime = INPUT_MS + in.size() * 128 / 100 + HANG_MS + 20;
+  fprintf(f, "# ikbd_fuzz: %s\n", what);
+  fprintf(f, "runtime %d\n\n", runtime);
+  fprintf(f, "# 62500 bit/s like the fuzzer\n");
+  fprintf(f, "%d ser", RATE_MS);
+  for(size_t i=0;i<sizeof(rate_load);i++)
+    fprintf(f, " %02x", rate_load[i]);
+  fprintf(f, "\n%d ser", RATE_MS + 10);
+  for(size_t i=0;i<sizeof(rate_reset);i++)
+    fprintf(f, " %02x", rate_reset[i]);
+  fprintf(f, "\n%d ser", INPUT_MS);
+  for(size_t i=0;i<in.size();i++)
+    fprintf(f, " %02x", in[i]);
+  fprintf(f, "\n");
+  return !fclose(f);
+}
+
+static void stats(uint64_t execs, uint64_t us, uint64_t sim_ns, size_t corpus,
+		  uint64_t items, int crashes, int hangs) {
+  printf("%8llu execs %6.0f/s %5.1fx realtime, corpus %d, %llu addresses and branch directions, "
+	 "%d crashes, %d hangs\n", (unsigned long long)execs, execs * 1e6 / us,
+	 sim_ns / 1000.0 / us, (int)corpus, (unsigned long long)items, crashes, hangs);
+}
+
+static void usage(const char *name) {
+  printf("Usage: %s [-m rtl|sim] [-j jobs] [-n execs] [-t seconds] [-s seed]\n", name);
+  printf("          [-o dir] [scenario...]\n");
+  printf("  -m  model to fuzz, the C++ model (default) or the verilated rtl\n");
+  printf("  -j  number of inputs run in parallel (default 1)\n");
+  printf("  -n  stop after this many inputs\n");
+  printf("  -t  stop after this many seconds\n");
+  printf("  -s  seed of the random numbers (default 1)\n");
+  printf("  -o  write the corpus, crashes and hangs as scenarios to dir\n");
+  printf("      (default fuzz)\n");
+  printf("  The bytes the scenarios send to the ikbd are the initial corpus\n");
+  printf("  besides a set of valid commands.\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  const char *model = "sim", *dir = "fuzz";
+  int jobs = 1;
+  uint64_t max_execs = UINT64_MAX, max_us = UINT64_MAX;
+
+  int c;
+  while((c = getopt(argc, argv, "m:j:n:t:s:o:h")) != -1) {
+    switch(c) {
+    case 'm': model = optarg; break;
+    case 'j': jobs = atoi(optarg); break;
+    case 'n': max_execs = strtoull(optarg, NULL, 10); break;
+    case 't': max_us = strtoull(optarg, NULL, 10) * 1000000; break;
+    case 's': seed = strtoul(optarg, NULL, 10); break;
+    case 'o': dir = optarg; break;
+    default:  usage(argv[0]);
+    }
+  }
+  if(jobs < 1 || !seed || (strcmp(model, "sim") && strcmp(model, "rtl")))
+    usage(argv[0]);
+
+  // the initial corpus: the commands sent by the scenarios and the
+  // dictionary
+  std::vector<std::vector<uint8_t> > corpus(dictionary);
+  for(int i=optind;i<argc;i++) {
+    scenario s;
+    if(!s.load(argv[i])) return 1;
+    for(size_t e=0;e<s.events.size();e++) {
+      if(s.events[e].type != TSER) continue;
+      std::vector<uint8_t> v;
+      for(size_t k=0;k<s.events[e].io.size() && v.size()<MAX_LEN;k++)
+	v.push_back(s.events[e].io[k].value);
+      corpus.push_back(v);
+    }
+  }
+  size_t seeds = corpus.size();
+
+  mkdir(dir, 0777);
+
+  ikbd_model *m;
+  if(!strcmp(model, "sim")) m = new ikbd_sim;
+  else                      m = new ikbd_rtl;
+  boot(m);
+
+  result *shm = (result*)mmap(NULL, jobs * sizeof(result), PROT_READ | PROT_WRITE,
+			      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(shm == MAP_FAILED) {
+    printf("Unable to allocate shared memory\n");
+    return 1;
+  }
+
+  std::vector<uint8_t> reached(COV_ITEMS/8, 0), hang_reached(COV_ITEMS/8, 0);
+  std::map<uint16_t, int> crash_pcs;
+  std::vector<pid_t> pids(jobs, 0);
+  std::vector<std::vector<uint8_t> > inputs(jobs);
+  std::vector<bool> is_seed(jobs);
+  uint64_t execs = 0, started = 0, sim_ns = 0, items = 0;
+  int crashes = 0, hangs = 0, queued = 0;
+  uint64_t t0 = now_us(), last_stats = t0;
+
+  for(;;) {
+    // keep all slots busy
+    bool stop = started >= max_execs || now_us() - t0 >= max_us;
+    for(int j=0;j<jobs && !stop;j++) {
+      if(pids[j]) continue;
+      is_seed[j] = started < seeds;
+      inputs[j] = is_seed[j]?corpus[started]:mutate(corpus, rnd(corpus.size()));
+      started++;
+
+      fflush(stdout);
+      pid_t pid = fork();
+      if(pid == 0) {
+	execute(m, inputs[j], &shm[j]);
+	_exit(0);
+      }
+      pids[j] = pid;
+    }
+
+    int status;
+    pid_t pid = wait(&status);
+    if(pid < 0) break;
+
+    int j = 0;
+    while(j < jobs && pids[j] != pid) j++;
+    if(j == jobs) continue;
+    pids[j] = 0;
+    execs++;
+
+    const result &r = shm[j];
+    char name[64], what[128];
+
+    // the model itself failed
+    if(!WIFEXITED(status) || WEXITSTATUS(status)) {
+      sprintf(name, "/crash_%04d.scn", crashes++);
+      sprintf(what, "the model crashed with signal %d", WIFSIGNALED(status)?WTERMSIG(status):0);
+      write_scenario(dir + std::string(name), inputs[j], what);
+      printf("%s%s: %s\n", dir, name, what);
+      continue;
+    }
+    sim_ns += r.time;
+
+    if(r.status == RES_CRASH && !crash_pcs[r.last_pc]++) {
+      sprintf(name, "/crash_%04d.scn", crashes++);
+      sprintf(what, "the pc left the rom and ram after $%04x", r.last_pc);
+      write_scenario(dir + std::string(name), inputs[j], what);
+      printf("%s%s: %s\n", dir, name, what);
+    }
+
+    bool fresh = false;
+    for(int i=0;i<COV_ITEMS/8;i++) {
+      uint8_t n = r.items[i] & ~(r.status == RES_HANG?hang_reached[i]:reached[i]);
+      if(!n) continue;
+      fresh = true;
+      if(r.status == RES_HANG) hang_reached[i] |= n;
+      else {
+	reached[i] |= n;
+	items += __builtin_popcount(n);
+      }
+    }
+
+    if(r.status == RES_HANG && fresh) {
+      sprintf(name, "/hang_%04d.scn", hangs++);
+      sprintf(what, "no tx and no main loop for %dms", HANG_MS);
+      write_scenario(dir + std::string(name), inputs[j], what);
+      printf("%s%s: %s\n", dir, name, what);
+    }
+
+    if(r.status == RES_OK && fresh) {
+      if(!is_seed[j]) corpus.push_back(inputs[j]);
+      sprintf(name, "/queue_%04d.scn", queued++);
+      sprintf(what, "%d addresses and branch directions", (int)items);
+      write_scenario(dir + std::string(name), inputs[j], what);
+    }
+
+    uint64_t t = now_us();
+    if(t - last_stats >= 1000000) {
+      last_stats = t;
+      stats(execs, t - t0, sim_ns, corpus.size(), items, crashes, hangs);
+    }
+  }
+  stats(execs, now_us() - t0, sim_ns, corpus.size(), items, crashes, hangs);
+
+  delete m;
+  return crashes?1:0;
+}
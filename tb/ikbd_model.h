@@ -0,0 +1,83 @@
+/*
+  ikbd_model.h
+
+  Common pin level interface of all ikbd models. The member names
+  match the ports of ikbd.sv and thus those of the verilated Vikbd,
+  so the testbench can drive any of the models the same way.
+*/
+
+#ifndef IKBD_MODEL_H
+#define IKBD_MODEL_H
+
+#include <stdint.h>
+#include "verilated_save.h"
+
+class ikbd_model {
+public:
+  ikbd_model() :
+    clk(0), res(0), periph_en(1),
+    ps2_kbd_clk(1), ps2_kbd_data(1), ps2_mouse_clk(1), ps2_mouse_data(1),
+    rx(1), joystick0(0), joystick1(0), sci_tx_slots(0),
+    tx(1), caps_lock(0), joy_port_toggle(0),
+    dbg_pc(0), dbg_a(0), dbg_b(0), dbg_cc(0), dbg_x(0), dbg_sp(0),
+    dbg_icnt(0), dbg_opcode(0), dbg_trcsr(0), dbg_rmcr(0), dbg_po2(0), dbg_po3(0), dbg_po4(0), dbg_mouse(0) { }
+  virtual ~ikbd_model() { }
+
+  // inputs. periph_en is the 2MHz enable of everything but the cpu
+  // core, see ikbd.sv
+  uint8_t clk, res, periph_en;
+  uint8_t ps2_kbd_clk, ps2_kbd_data;
+  uint8_t ps2_mouse_clk, ps2_mouse_data;
+  uint8_t rx;
+  uint8_t joystick0, joystick1;
+
+  // configuration, this is set once by the testbench and not part
+  // of the snapshots
+  uint8_t sci_tx_slots;
+
+  // outputs
+  uint8_t tx, caps_lock, joy_port_toggle;
+
+  // debug outputs. The cpu state is latched whenever an instruction
+  // is fetched together with its opcode and dbg_icnt counts the
+  // instructions executed. dbg_trcsr and dbg_rmcr are the sci status
+  // and its rate. dbg_mouse are the quadrature and button lines of
+  // the ps2 mouse
+  uint16_t dbg_pc;
+  uint8_t dbg_a, dbg_b, dbg_cc;
+  uint16_t dbg_x, dbg_sp;
+  uint32_t dbg_icnt;
+  uint8_t dbg_opcode;
+  uint8_t dbg_trcsr, dbg_rmcr;
+  uint8_t dbg_po2, dbg_po3, dbg_po4;
+  uint8_t dbg_mouse;
+
+  virtual void eval() = 0;
+  virtual const char *name() const = 0;
+  // a model may detect a failure by itself
+  virtual bool failed() const { return false; }
+
+  // skip up to the given number of CLKx2 cycles in one go if the
+  // model knows how it evolves while the inputs stay as they are.
+  // Returns the number of cycles skipped, the clock is low
+  virtual uint64_t fast_forward(uint64_t) { return 0; }
+
+  // snapshot of the complete model state. Derived models save the
+  // pins via these and then append their own state
+  virtual bool savable() const { return true; }
+  virtual void save(VerilatedSerialize &os) {
+    os << clk << res << periph_en << ps2_kbd_clk << ps2_kbd_data << ps2_mouse_clk << ps2_mouse_data
+       << rx << joystick0 << joystick1 << tx << caps_lock << joy_port_toggle
+       << dbg_pc << dbg_a << dbg_b << dbg_cc << dbg_x << dbg_sp
+       << dbg_icnt << dbg_opcode << dbg_trcsr << dbg_rmcr << dbg_po2 << dbg_po3 << dbg_po4 << dbg_mouse;
+  }
+
+  virtual void restore(VerilatedDeserialize &os) {
+    os >> clk >> res >> periph_en >> ps2_kbd_clk >> ps2_kbd_data >> ps2_mouse_clk >> ps2_mouse_data
+       >> rx >> joystick0 >> joystick1 >> tx >> caps_lock >> joy_port_toggle
+       >> dbg_pc >> dbg_a >> dbg_b >> dbg_cc >> dbg_x >> dbg_sp
+       >> dbg_icnt >> dbg_opcode >> dbg_trcsr >> dbg_rmcr >> dbg_po2 >> dbg_po3 >> dbg_po4 >> dbg_mouse;
+  }
+};
+
+#endif // IKBD_MODEL_H
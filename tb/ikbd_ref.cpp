@@ -0,0 +1,1315 @@
+/*
+  ikbd_ref.cpp
+
+  Reference model of the ikbd's protocol, see ikbd_ref.h. The rom
+  addresses in the comments refer to rom/IKBD.ASM.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "ikbd_ref.h"
+
+// keymap entries, see rom/keymap.hex
+#define KEY_VALID    0x80
+#define KEY_COL(k)   (((k) >> 3) & 15)
+#define KEY_ROW(k)   ((k) & 7)
+#define KEY_TOGGLE   15      // joy_port_toggle, no matrix key
+
+// joystick bits as in scenario.h
+#define JOY_DIRS  0x0f
+#define JOY_FIRE  0x10
+
+// one column every 2ms, keys pressed for less than a full scan may
+// be missed and keys pressed within one scan come in column order
+#define SCAN_NS      32000000ull
+// the rom debounces the joystick directions and fire buttons
+#define DEBOUNCE_NS  15000000ull
+// time the rom takes to see a change, e.g. before an interrogation
+#define SETTLE_NS     5000000ull
+// ps2.sv outputs one quadrature step every 1280 cycles
+#define STEP_NS        640000ull
+// the rom's self test after a reset command
+#define BOOT_NS      70000000ull
+// the memory load waits about 80ms for each byte, see fbf0
+#define LOAD_NS      60000000ull
+// expected messages not seen within this time are missing
+#define TIMEOUT_NS  100000000ull
+
+// the output buffer at $d9 holds 21 bytes
+#define OUT_BUFFER  21
+
+// rom tables
+#define ROM_MODIFIERS  0xf206   // codes of the modifier columns
+#define ROM_KEYCODES   0xf311   // codes of the other columns
+#define ROM_MONTHS     0xfed0   // days+1 per bcd month-1
+#define ROM_ARROWS     0xf679   // mouse keycode mode
+
+static const char *mkey_name[4] = { "up", "down", "right", "left" };
+
+ikbd_ref::ikbd_ref(FILE *out, const char *rom_file, const char *keys_file) :
+  out(out), pair_next(1), out_free(OUT_BUFFER),
+  tod_time(0), load_addr(0), load_left(0), load_time(0), boot_until(0), drop_next(false),
+  kbd_release(false), kbd_ext(false),
+  keys_typed(0), keys_reported(0), keys_short(0), keys_missing(0), keys_rollover(0), keys_reordered(0),
+  last_key_time(0), last_key_code(0),
+  mouse_state(0), mouse_sign(0), mouse_btn(0), step_time(0), settle_time(0),
+  mouse_active(true), buttons(0), mouse_unsure(false),
+  msg_time(0), msg_len(0), rel_header(0),
+  matched(0), mismatched(0), missing(0), unexpected(0), deviations(0), unchecked(0),
+  stopped(false), stop_time(0) {
+
+  if(!load(rom_file, keys_file))
+    stop(0, "rom or keymap not found");
+
+  memset(matrix, 0, sizeof(matrix));
+  memset(key_time, 0, sizeof(key_time));
+  memset(key_pair, 0, sizeof(key_pair));
+  memset(tod, 0, sizeof(tod));
+  joy[0] = joy[1] = 0;
+  for(int i=0;i<2;i++) {
+    pending[i] = quad[i] = 0;
+    rel_expect[i] = rel_got[i] = 0;
+    key_acc[i] = 0;
+    history[i].push_back( { 0, 0 } );
+  }
+  for(int i=0;i<4;i++)
+    mkeys_expect[i] = mkeys_got[i] = 0;
+
+  reset(0);
+}
+
+// same formats as read by $readmemh, the keymap with // comments
+bool ikbd_ref::load(const char *rom_file, const char *keys_file) {
+  FILE *f = fopen(rom_file, "r");
+  if(!f) return false;
+
+  unsigned int v, n = 0;
+  while(n < sizeof(rom) && fscanf(f, "%x", &v) == 1)
+    rom[n++] = v;
+  fclose(f);
+  if(n != sizeof(rom)) return false;
+
+  f = fopen(keys_file, "r");
+  if(!f) return false;
+
+  char line[256];
+  n = 0;
+  while(n < sizeof(keymap) && fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "/")] = 0;
+    for(char *t = strtok(line, " \t\r\n"); t && n < sizeof(keymap); t = strtok(NULL, " \t\r\n"))
+      keymap[n++] = strtoul(t, NULL, 16);
+  }
+  fclose(f);
+  return n == sizeof(keymap);
+}
+
+// ========= rom state =========
+
+// the state after the rom cleared its ram from $89 on, see f0ec.
+// The time of day survives a reset
+void ikbd_ref::reset(uint64_t t) {
+  mouse_on = true;
+  mouse_mode = M_REL;
+  joy0_mode = y_bottom = paused = false;
+  button_action = 0;
+  threshold[0] = threshold[1] = 1;
+  scale[0] = scale[1] = 1;
+  key_delta[0] = key_delta[1] = 0;
+  abs_max[0] = abs_max[1] = 0;
+  abs_pos[0] = abs_pos[1] = 0;
+  abs_buttons = 0;
+  abs_moved = false;
+  key_acc[0] = key_acc[1] = 0;
+
+  joy_on = true;
+  joy_mode = J_EVENT;
+  monitor_rate = 0;
+  joy_reported[0] = joy_reported[1] = 0;
+
+  cmd.clear();
+  load_left = 0;
+  drop_next = false;
+  out_free = OUT_BUFFER;
+  boot_until = t;
+}
+
+void ikbd_ref::power_up(uint64_t t) {
+  reset(t);
+  boot_until = t + BOOT_NS;
+  reply(t, { 0xf1 });
+}
+
+// most commands end in the resume command at f91b
+void ikbd_ref::resume() {
+  if(paused) {
+    paused = false;
+    out_free = OUT_BUFFER;
+  }
+}
+
+// ========= expected messages =========
+
+// while the output is paused messages are kept in the rom's output
+// buffer, those that don't fit are dropped, see fd34
+void ikbd_ref::emit(std::deque<expect> &q, uint64_t t, const std::vector<int> &bytes,
+		    int pair, bool optional) {
+  if(paused && !optional) {
+    if((int)bytes.size() > out_free) return;
+    out_free -= bytes.size();
+  }
+  q.push_back( { t, bytes, std::vector<int>(), optional, pair } );
+}
+
+void ikbd_ref::reply(uint64_t t, const std::vector<int> &bytes, const std::vector<int> &alt) {
+  emit(replies, t, bytes);
+  if(!alt.empty() && !replies.empty() && replies.back().time == t)
+    replies.back().alt = alt;
+}
+
+// ========= keyboard =========
+
+// the rom counts the columns from 1 in $8a. Column 1 only has ctrl,
+// columns 2-4 a modifier in row 4-7 and f1-f3 in the others, see
+// f1e5 and f2f7
+int ikbd_ref::key_code(int col, int row) const {
+  int c = col + 1;
+  if(c < 5) {
+    if(row == col + 4) return rom[ROM_MODIFIERS - 0xf000 + col];
+    return (c > 1)?rom[ROM_KEYCODES - 0xf000 + c]:0;
+  }
+  return rom[ROM_KEYCODES - 0xf000 + (c - 4) * 8 + row];
+}
+
+// The rom frees a slot once its scan sees the release, up to a scan
+// after it. Until then it may hold a key back
+void ikbd_ref::key_make(int col, int row, uint64_t t) {
+  bool held = false;
+  if(col >= 4 || row != col + 4) {
+    if(key_slots.size() >= 2) return;
+
+    size_t busy = key_slots.size();
+    for(size_t i=0;i<key_freed.size();i++)
+      if(key_freed[i] + SCAN_NS > t) busy++;
+    held = busy >= 2;
+    key_slots.push_back(col << 3 | row);
+  }
+  key_time[col][row] = t;
+  key_pair[col][row] = pair_next++;
+  emit(keys, t, { key_code(col, row) }, key_pair[col][row], held);
+  if(held) pairs_held.push_back(key_pair[col][row]);
+}
+
+// The rom reports the modifiers and at most two other keys at a
+// time, see f252. A third key is reported once one of these was
+// released, if it is still held then
+void ikbd_ref::key(int col, int row, bool down, uint64_t t) {
+  uint8_t bit = 1 << row;
+  if(down == !!(matrix[col] & bit)) return;
+  matrix[col] ^= bit;
+
+  int code = key_code(col, row);
+  if(!code) return;
+
+  if(down) {
+    keys_typed++;
+    key_pair[col][row] = 0;
+
+    // pressed again within a scan of its release, the rom may see
+    // neither
+    bool again = false;
+    for(size_t i=0;i<keys.size();i++)
+      if(keys[i].bytes[0] == (code | 0x80) && keys[i].time + SCAN_NS > t) {
+	keys[i].optional = true;
+	again = true;
+      }
+
+    size_t n = keys.size();
+    key_time[col][row] = t;
+    key_make(col, row, t);
+    if(again && keys.size() > n) keys.back().optional = true;
+    return;
+  }
+
+  // released before it was reported
+  int pair = key_pair[col][row];
+  if(!pair) {
+    keys_rollover++;
+    fprintf(out, "@%.2fµs REF key %02x not reported: two other keys were held all the time\n",
+	    t/1000.0, code);
+    return;
+  }
+
+  for(size_t i=0;i<key_slots.size();i++)
+    if(key_slots[i] == (col << 3 | row)) {
+      key_slots.erase(key_slots.begin() + i);
+      while(!key_freed.empty() && key_freed.front() + SCAN_NS < t)
+	key_freed.erase(key_freed.begin());
+      key_freed.push_back(t);
+    }
+
+  // a press shorter than a scan may not be seen at all. If its make
+  // code was matched already the break code has to follow
+  bool seen = false;
+  for(size_t i=0;i<pairs_seen.size();i++)
+    if(pairs_seen[i] == pair) {
+      seen = true;
+      pairs_seen.erase(pairs_seen.begin() + i);
+      break;
+    }
+
+  bool held = false;
+  for(size_t i=0;i<pairs_held.size();i++)
+    if(pairs_held[i] == pair) held = true;
+
+  bool short_press = !seen && (held || t - key_time[col][row] < SCAN_NS);
+  if(short_press)
+    for(size_t i=0;i<keys.size();i++)
+      if(keys[i].pair == pair)
+	keys[i].optional = true;
+  emit(keys, t, { code | 0x80 }, seen?0:pair, short_press);
+
+  for(int c=0;c<15 && key_slots.size() < 2;c++)
+    for(int r=0;r<8 && key_slots.size() < 2;r++)
+      if((matrix[c] & (1 << r)) && !key_pair[c][r] && key_code(c, r))
+	key_make(c, r, t);
+}
+
+void ikbd_ref::ps2_byte(int dev, uint8_t b, uint64_t t) {
+  advance(t);
+  if(stopped) return;
+
+  if(dev) {
+    mouse_packet_byte(b, t);
+    return;
+  }
+
+  // decoded like ps2.sv does
+  if(b == 0xf0) {
+    kbd_release = true;
+    return;
+  }
+  if(b == 0xe0) {
+    kbd_ext = true;
+    return;
+  }
+
+  uint8_t k = keymap[(kbd_ext?0x100:0) | b];
+  if((k & KEY_VALID) && KEY_COL(k) != KEY_TOGGLE)
+    key(KEY_COL(k), KEY_ROW(k), !kbd_release, t);
+
+  kbd_release = kbd_ext = false;
+}
+
+// ========= mouse =========
+
+// the four byte packets of a wheel mouse as parsed by ps2.sv. The
+// buttons change with the first byte, the motion is stepped out
+void ikbd_ref::mouse_packet_byte(uint8_t d, uint64_t t) {
+  switch(mouse_state) {
+  case 0:
+    if(!(d & 0x08)) return;
+    mouse_sign = (d >> 4) & 3;
+    mouse_state = 1;
+    if((d & 3) != mouse_btn) {
+      mouse_btn = d & 3;
+      mouse_active = true;
+      buttons_update(t);
+    }
+    break;
+  case 1:
+    pending[0] += (mouse_sign & 1)?d - 0x100:d;
+    mouse_state = 2;
+    break;
+  case 2:
+    pending[1] += (mouse_sign & 2)?d - 0x100:d;
+    mouse_state = 3;
+    break;
+  default: {
+    // the wheel presses cursor up or down in matrix column 12 for a
+    // few ms only
+    int z = ((~d + 1) & 0x1f) << 4;
+    if(z) {
+      int row = (z & 0x100)?1:4;
+      int code = key_code(12, row);
+      int pair = pair_next++;
+      emit(keys, t, { code }, pair, true);
+      emit(keys, t, { code | 0x80 }, pair, true);
+    }
+    mouse_state = 0;
+  } break;
+  }
+
+  if(pending[0] || pending[1]) {
+    mouse_active = true;
+    if(step_time < t) step_time = t;
+    int n = abs(pending[0]) > abs(pending[1])?abs(pending[0]):abs(pending[1]);
+    settle_time = step_time + n * STEP_NS + SETTLE_NS;
+  }
+}
+
+// port 0 carries the mouse or joystick 0, whichever changed last,
+// see ikbd.sv. The right button is wired to joystick 1's fire
+bool ikbd_ref::fire_line(int port) const {
+  if(port) return (joy[1] & JOY_FIRE) || (mouse_active && (mouse_btn & 2));
+  return mouse_active?(mouse_btn & 1):(joy[0] & JOY_FIRE);
+}
+
+// atari joystick byte of a port, fire in bit 7. The quadrature
+// signals are unknown while ps2.sv is still stepping
+int ikbd_ref::port_value(int port) const {
+  int fire = fire_line(port)?0x80:0;
+  if(port) return fire | (joy[1] & JOY_DIRS);
+  if(!mouse_active) return fire | (joy[0] & JOY_DIRS);
+  if(pending[0] || pending[1]) return -1;
+
+  // gray code position of the x and y signals
+  static const int gray[4] = { 0, 1, 3, 2 };
+  return fire | (gray[quad[1] & 3] << 2) | gray[quad[0] & 3];
+}
+
+// one quadrature step of an axis. ps2.sv steps forward for motion
+// to the left and upwards. The rom reports y downwards unless
+// y=0 is at the bottom, see f42d
+void ikbd_ref::mouse_step(int axis, int dir) {
+  quad[axis] += axis?dir:-dir;
+  if(!mouse_on || joy0_mode) return;
+
+  int d = (axis && mouse_mode != M_KEY && !y_bottom)?-dir:dir;
+  switch(mouse_mode) {
+  case M_REL:
+    rel_expect[axis] += d;
+    break;
+  case M_ABS: {
+    int p = abs_pos[axis] + d * scale[axis];
+    if(p < 0) p = 0;
+    if(p >= abs_max[axis]) p = abs_max[axis];
+    abs_pos[axis] = p;
+    abs_moved = true;
+  } break;
+  case M_KEY:
+    // see f5a8, the accumulator is cleared after each key
+    key_acc[axis] += d;
+    if(abs(key_acc[axis]) >= key_delta[axis] || abs(key_acc[axis]) >= 127) {
+      mkeys_expect[axis?(key_acc[axis] > 0?0:1):(key_acc[axis] > 0?2:3)]++;
+      key_acc[axis] = 0;
+    }
+    break;
+  }
+}
+
+// the steps ps2.sv output up to time t
+void ikbd_ref::mouse_steps(uint64_t t) {
+  if(!pending[0] && !pending[1]) return;
+
+  while(step_time + STEP_NS <= t && (pending[0] || pending[1])) {
+    step_time += STEP_NS;
+    for(int i=0;i<2;i++) {
+      int dir = (pending[i] > 0) - (pending[i] < 0);
+      if(!dir) continue;
+      pending[i] -= dir;
+      mouse_step(i, dir);
+    }
+  }
+
+  if(!pending[0] && !pending[1])
+    joy_update(t);
+}
+
+// a change of the buttons the rom sees, see f39b. The rom keeps
+// the buttons in $c0 with the left one in bit 2
+void ikbd_ref::buttons_update(uint64_t t) {
+  uint8_t b = (fire_line(0)?4:0) | (fire_line(1)?2:0);
+  uint8_t changed = b ^ buttons;
+  joy_update(t);
+  if(!changed) return;
+  buttons = b;
+
+  if(!mouse_on || joy0_mode) return;
+
+  // $c1: bit 0/1 right pressed/released, bit 2/3 left
+  uint8_t press = b & changed, release = ~b & changed;
+  uint8_t ev = ((press | press >> 1) & 0x05) | ((release | release << 1) & 0x0a);
+
+  // buttons as keys in keycode mode or if asked for, see f62b
+  if(mouse_mode == M_KEY || (button_action & 4)) {
+    if(mouse_mode == M_ABS) abs_buttons |= ev;
+    if(ev & 0x01) emit(keys, t, { 0x75 });
+    if(ev & 0x02) emit(keys, t, { 0xf5 });
+    if(ev & 0x04) emit(keys, t, { 0x74 });
+    if(ev & 0x08) emit(keys, t, { 0xf4 });
+    return;
+  }
+
+  if(mouse_mode == M_ABS) {
+    abs_buttons |= ev;
+    int action = ((ev & 0x05)?1:0) | ((ev & 0x0a)?2:0);
+    if(action & button_action) {
+      int s = abs_moved?REF_SOFT:0;
+      emit(abs_events, t, { 0xf7, ev, s | (abs_pos[0] >> 8), s | (abs_pos[0] & 0xff),
+			     s | (abs_pos[1] >> 8), s | (abs_pos[1] & 0xff) });
+    }
+    return;
+  }
+
+  // a relative report with the new buttons, left in bit 1
+  if(mouse_mode == M_REL) {
+    debounce(rel_buttons, t);
+    emit(rel_buttons, t, { 0xf8 | (b >> 1), REF_ANY, REF_ANY }, 0, rel_buttons.size() &&
+	 rel_buttons.back().optional);
+  }
+}
+
+// ========= joystick =========
+
+void ikbd_ref::joystick(int port, uint8_t state, uint64_t t) {
+  advance(t);
+  if(stopped) return;
+
+  uint8_t old = joy[port];
+  joy[port] = state;
+  if(!port && old != state) {
+    // the joystick takes over port 0. Its directions look like
+    // mouse motion to the rom if it is reporting the mouse
+    mouse_active = false;
+    if(mouse_on && !joy0_mode && ((old ^ state) & JOY_DIRS))
+      mouse_unsure = true;
+  }
+  buttons_update(t);
+}
+
+void ikbd_ref::history_add(int port, uint64_t t) {
+  int v = port_value(port);
+  if(history[port].back().value == v) return;
+  history[port].push_back( { t, v } );
+  while(history[port].size() > 64)
+    history[port].pop_front();
+}
+
+// did the masked bits of the port have this value at some time
+// between from and to
+bool ikbd_ref::history_has(int port, int mask, int value, uint64_t from, uint64_t to) const {
+  const std::deque<sample> &h = history[port];
+  for(size_t i=0;i<h.size();i++) {
+    uint64_t end = (i + 1 < h.size())?h[i+1].time:UINT64_MAX;
+    if(h[i].time <= to && end >= from && (h[i].value < 0 || (h[i].value & mask) == value))
+      return true;
+  }
+  return false;
+}
+
+// A state shorter than the debounce time may be skipped. Then the
+// change back may be missing as well
+void ikbd_ref::debounce(std::deque<expect> &q, uint64_t t) {
+  if(!q.empty() && t - q.back().time < DEBOUNCE_NS)
+    q.back().optional = true;
+}
+
+// the joystick values the rom reports, see f681. Joystick 0 is only
+// read if it replaces the mouse, the fire buttons are read if it
+// does or for joystick 1 if the mouse is off
+void ikbd_ref::joy_update(uint64_t t) {
+  history_add(0, t);
+  history_add(1, t);
+  if(!joy_on || joy_mode == J_MONITOR || joy_mode == J_FIRE) return;
+
+  for(int p=0;p<2;p++) {
+    if(!p && !joy0_mode) continue;
+
+    int v = port_value(p);
+    if(v < 0) {
+      // a value from the stepping mouse, whatever it is
+      joy_reported[p] = -1;
+      continue;
+    }
+
+    bool fire = joy0_mode || (p && !mouse_on);
+    if(!fire) v = (v & JOY_DIRS) | ((joy_reported[p] < 0)?0:(joy_reported[p] & 0x80));
+    if(v == joy_reported[p]) continue;
+
+    int old = joy_reported[p];
+    joy_reported[p] = v;
+    if(joy_mode != J_EVENT) continue;
+
+    // the fire button is debounced apart from the directions, so
+    // either may be reported first
+    std::deque<expect> &q = joy_events[p];
+    debounce(q, t);
+    bool optional = old < 0 || (q.size() && q.back().optional);
+    if(old >= 0 && (old ^ v) & 0x80 && (old ^ v) & JOY_DIRS) {
+      emit(q, t, { p?0xff:0xfe, (old & 0x80) | (v & JOY_DIRS) }, 0, true);
+      emit(q, t, { p?0xff:0xfe, (v & 0x80) | (old & JOY_DIRS) }, 0, true);
+    }
+    emit(q, t, { p?0xff:0xfe, v }, 0, optional);
+  }
+}
+
+// ========= commands =========
+
+static int command_length(uint8_t c) {
+  switch(c) {
+  case 0x07: case 0x17: case 0x80:
+    return 2;
+  case 0x0a: case 0x0b: case 0x0c: case 0x21: case 0x22:
+    return 3;
+  case 0x20:
+    return 4;
+  case 0x09:
+    return 5;
+  case 0x0e:
+    return 6;
+  case 0x19: case 0x1b:
+    return 7;
+  }
+  return 1;
+}
+
+void ikbd_ref::command(uint8_t b, uint64_t t) {
+  advance(t);
+  if(stopped) return;
+
+  if(t < boot_until) {
+    stop(t, "byte sent while the ikbd boots");
+    return;
+  }
+
+  if(load_left) {
+    if(t - load_time > LOAD_NS) {
+      stop(t, "memory load timed out");
+      return;
+    }
+    // a $00 looks like no command to the receive interrupt and is
+    // dropped, see ff0b
+    load_time = t;
+    if(!b) return;
+    if(!--load_left) drop_next = true;
+    return;
+  }
+
+  // the rom leaves its input counter at 1 after a memory load, the
+  // next byte only resets it
+  if(drop_next) {
+    drop_next = false;
+    return;
+  }
+
+  if(cmd.empty() && !b) return;
+  cmd.push_back(b);
+  if((int)cmd.size() < command_length(cmd[0])) return;
+
+  execute(t);
+  cmd.clear();
+}
+
+// status report, see fcd7. The command is followed by the
+// parameters and padded with zeros to seven bytes
+void ikbd_ref::status(uint64_t t, int code, const uint8_t *p, int n) {
+  std::vector<int> r = { 0xf6, code };
+  for(int i=0;i<6;i++)
+    r.push_back(i < n?p[i]:0);
+  reply(t, r);
+}
+
+void ikbd_ref::mouse_command(uint64_t t, int mode) {
+  // see fbaf, a mouse mode ends joystick monitoring and the mouse
+  // takes port 0 back from joystick 0
+  mouse_on = true;
+  mouse_mode = mode;
+  joy0_mode = false;
+  rel_header = 0;
+  key_acc[0] = key_acc[1] = 0;
+  if(joy_mode == J_MONITOR || joy_mode == J_FIRE || !joy_on)
+    joy_mode = J_EVENT;
+  if(joy_mode == J_EVENT || joy_mode == J_INTERROGATE)
+    joy_on = true;
+  joy_update(t);
+  resume();
+}
+
+// $14, $15, $17: joystick 0 replaces the mouse, see fa47
+void ikbd_ref::joystick_command(uint64_t t, int mode) {
+  joy_on = true;
+  joy_mode = mode;
+  joy0_mode = true;
+  joy_reported[0] = joy_reported[1] = 0;
+  joy_update(t);
+  resume();
+}
+
+// time of day at t, see the clock in the timer interrupt at fdb6.
+// It only runs if a month is set
+void ikbd_ref::tod_now(uint64_t t, uint8_t *r) {
+  memcpy(r, tod, 6);
+  if(!r[1] || t < tod_time) return;
+
+  static const uint8_t limit_hms[3] = { 0x24, 0x60, 0x60 };
+  for(uint64_t s = (t - tod_time) / 1000000000ull; s; s--) {
+    for(int i=5;i>=0;i--) {
+      uint8_t lim;
+      if(i >= 3) lim = limit_hms[i-3];
+      else if(i == 2) {
+	if(r[1] == 0x02) {
+	  // february, the year is leap if its bcd value is a multiple of 4
+	  int y = r[0] + ((r[0] & 0x10)?0x0a:0);
+	  lim = (r[2] >= 0x28 && !(y & 3))?0x30:0x29;
+	} else
+	  lim = rom[ROM_MONTHS - 0xf000 + r[1] - 1];
+      } else if(i == 1) lim = 0x13;
+      else lim = 0;
+
+      // bcd increment
+      int v = r[i] + 1;
+      if((v & 0x0f) > 9) v += 6;
+      v &= 0xff;
+      if(i && v == lim) {
+	r[i] = (i <= 2)?1:0;
+	continue;
+      }
+      r[i] = (i || v <= 0x99)?v:0;
+      break;
+    }
+  }
+}
+
+void ikbd_ref::execute(uint64_t t) {
+  const uint8_t *p = cmd.data() + 1;
+  char reason[64];
+
+  switch(cmd[0]) {
+  case 0x07:   // set mouse button action
+    button_action = p[0];
+    resume();
+    break;
+  case 0x08:   // relative mouse
+    mouse_command(t, M_REL);
+    break;
+  case 0x09:   // absolute mouse, the position is kept
+    abs_max[0] = p[0] << 8 | p[1];
+    abs_max[1] = p[2] << 8 | p[3];
+    mouse_command(t, M_ABS);
+    break;
+  case 0x0a:   // mouse keycode mode
+    key_delta[0] = p[0];
+    key_delta[1] = p[1];
+    mouse_command(t, M_KEY);
+    break;
+  case 0x0b:   // mouse threshold
+    threshold[0] = p[0];
+    threshold[1] = p[1];
+    resume();
+    break;
+  case 0x0c:   // mouse scale
+    scale[0] = p[0];
+    scale[1] = p[1];
+    resume();
+    break;
+  case 0x0d:   // interrogate mouse position, see fb39
+    if(joy0_mode || !mouse_on || mouse_mode != M_ABS) break;
+    {
+      // motion or buttons still on their way are unknown
+      bool moving = pending[0] || pending[1] || t < settle_time;
+      int s = (abs_moved || moving)?REF_SOFT:0;
+      reply(t, { 0xf7, moving?REF_ANY:abs_buttons, s | (abs_pos[0] >> 8), s | (abs_pos[0] & 0xff),
+		  s | (abs_pos[1] >> 8), s | (abs_pos[1] & 0xff) });
+      abs_buttons = 0;
+    }
+    resume();
+    break;
+  case 0x0e:   // load mouse position, see fb5f
+    abs_pos[0] = p[1] << 8 | p[2];
+    abs_pos[1] = p[3] << 8 | p[4];
+    abs_buttons = 0;
+    abs_moved = false;
+    mouse_on = true;
+    mouse_mode = M_ABS;
+    resume();
+    break;
+  case 0x0f:
+    y_bottom = true;
+    resume();
+    break;
+  case 0x10:
+    y_bottom = false;
+    resume();
+    break;
+  case 0x11:
+    resume();
+    break;
+  case 0x12:   // disable mouse
+    mouse_on = false;
+    joy_update(t);
+    resume();
+    break;
+  case 0x13:   // pause output
+    if(!paused) {
+      paused = true;
+      out_free = OUT_BUFFER;
+    }
+    break;
+  case 0x14:
+    joystick_command(t, J_EVENT);
+    break;
+  case 0x15:
+    joystick_command(t, J_INTERROGATE);
+    break;
+  case 0x16:   // interrogate joystick, see f9cc
+    if(!joy_on || (joy_mode != J_EVENT && joy_mode != J_INTERROGATE)) break;
+    {
+      bool recent = false;
+      for(int i=0;i<2;i++)
+	if(history[i].back().time + DEBOUNCE_NS > t) recent = true;
+      int j0 = joy0_mode?joy_reported[0]:0;
+      reply(t, { 0xfd, recent?REF_ANY:j0, recent?REF_ANY:joy_reported[1] });
+    }
+    resume();
+    break;
+  case 0x17:   // joystick monitoring
+    monitor_rate = p[0];
+    joystick_command(t, J_MONITOR);
+    break;
+  case 0x18:   // fire button monitoring
+    joy_on = true;
+    joy_mode = J_FIRE;
+    joy0_mode = true;
+    resume();
+    break;
+  case 0x19:
+    stop(t, "joystick keycode mode is not modelled");
+    break;
+  case 0x1a:   // disable joysticks
+    joy_on = false;
+    resume();
+    break;
+  case 0x1b: { // set time of day, invalid bcd values are ignored
+    uint8_t now[6];
+    tod_now(t, now);
+    for(int i=0;i<6;i++)
+      tod[i] = ((p[i] & 0x0f) < 0x0a && (p[i] & 0xf0) < 0xa0)?p[i]:now[i];
+    tod_time = t;
+    resume();
+  } break;
+  case 0x1c: { // interrogate time of day
+    uint8_t now[6], near[6];
+    tod_now(t, now);
+    std::vector<int> r = { 0xfc }, alt;
+    for(int i=0;i<6;i++)
+      r.push_back(now[i]);
+
+    // close to the next second either time is fine
+    tod_now(t + SETTLE_NS, near);
+    if(memcmp(now, near, 6)) {
+      alt.push_back(0xfc);
+      for(int i=0;i<6;i++)
+	alt.push_back(near[i]);
+    }
+    reply(t, r, alt);
+    resume();
+  } break;
+  case 0x20:   // memory load
+    load_addr = p[0] << 8 | p[1];
+    load_left = p[2];
+    load_time = t;
+    if(load_addr < 0x100 && load_addr + load_left > 0x80) {
+      sprintf(reason, "memory load into the rom's ram at $%04x", load_addr);
+      stop(t, reason);
+    }
+    break;
+  case 0x21: { // memory read, only the rom is known
+    int a = p[0] << 8 | p[1];
+    std::vector<int> r = { 0xf6, 0x20 };
+    for(int i=0;i<6;i++)
+      r.push_back((a + i >= 0xf000 && a + i <= 0xffff)?rom[a + i - 0xf000]:REF_ANY);
+    reply(t, r);
+    resume();
+  } break;
+  case 0x22:
+    sprintf(reason, "code executed at $%04x", p[0] << 8 | p[1]);
+    stop(t, reason);
+    break;
+  case 0x80:   // reset, see f990
+    if(p[0] != 0x01) break;
+    for(int c=0;c<15;c++)
+      if(matrix[c]) {
+	stop(t, "reset with a key held down");
+	return;
+      }
+    reset(t);
+    boot_until = t + BOOT_NS;
+    reply(t, { 0xf1 });
+    break;
+
+  default:
+    if(cmd[0] < 0x87 || cmd[0] > 0x9a) break;
+
+    // status inquiries are ignored while paused or monitoring, see f90a
+    if(paused || (joy_on && (joy_mode == J_MONITOR || joy_mode == J_FIRE)))
+      break;
+
+    switch(cmd[0]) {
+    case 0x87:
+      status(t, 0x07, &button_action, 1);
+      break;
+    case 0x88: case 0x89: case 0x8a: {
+      uint8_t v[4] = { (uint8_t)(abs_max[0] >> 8), (uint8_t)abs_max[0],
+		       (uint8_t)(abs_max[1] >> 8), (uint8_t)abs_max[1] };
+      if(mouse_mode == M_KEY)      status(t, 0x0a, key_delta, 2);
+      else if(mouse_mode == M_ABS) status(t, 0x09, v, 4);
+      else                         status(t, 0x08, NULL, 0);
+    } break;
+    case 0x8b:
+      status(t, 0x0b, threshold, 2);
+      break;
+    case 0x8c:
+      status(t, 0x0c, scale, 2);
+      break;
+    case 0x8f: case 0x90:
+      status(t, y_bottom?0x0f:0x10, NULL, 0);
+      break;
+    case 0x92:
+      status(t, mouse_on?0x00:0x12, NULL, 0);
+      break;
+    case 0x94: case 0x95: case 0x99:
+      status(t, (joy_mode == J_EVENT)?0x14:0x15, NULL, 0);
+      break;
+    case 0x9a:
+      status(t, joy_on?0x00:0x1a, NULL, 0);
+      break;
+    }
+  }
+}
+
+// ========= comparison =========
+
+void ikbd_ref::stop(uint64_t t, const char *reason) {
+  if(stopped) return;
+  stopped = true;
+  stop_time = t;
+  stop_reason = reason;
+  fprintf(out, "@%.2fµs REF stopped: %s\n", t/1000.0, reason);
+}
+
+void ikbd_ref::advance(uint64_t t) {
+  mouse_steps(t);
+}
+
+std::string ikbd_ref::hex(const std::vector<uint8_t> &v) const {
+  std::string s;
+  char b[4];
+  for(size_t i=0;i<v.size();i++) {
+    sprintf(b, "%s%02x", i?" ":"", v[i]);
+    s += b;
+  }
+  return s;
+}
+
+std::string ikbd_ref::hex(const std::vector<int> &v) const {
+  std::string s;
+  char b[4];
+  for(size_t i=0;i<v.size();i++) {
+    if(v[i] < 0) sprintf(b, "%s??", i?" ":"");
+    else         sprintf(b, "%s%02x", i?" ":"", v[i] & 0xff);
+    s += b;
+  }
+  return s;
+}
+
+// compares the message received with an expected one. A difference
+// in a soft byte only sets soft
+bool ikbd_ref::matches(const expect &e, bool *soft) const {
+  for(int a=0;a<2;a++) {
+    const std::vector<int> &b = a?e.alt:e.bytes;
+    if(b.size() != msg.size()) continue;
+
+    bool ok = true, s = false;
+    for(size_t i=0;i<b.size() && ok;i++) {
+      if(b[i] == REF_ANY || (b[i] & 0xff) == msg[i]) continue;
+      if(b[i] & REF_SOFT) s = true;
+      else ok = false;
+    }
+    if(ok) {
+      *soft = s;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ikbd_ref::report(const char *what, uint64_t t, const char *verdict, const std::vector<int> *exp) {
+  fprintf(out, "@%.2fµs REF %s %s: got %s", t/1000.0, what, verdict, hex(msg).c_str());
+  if(exp) fprintf(out, ", expected %s", hex(*exp).c_str());
+  fprintf(out, "\n");
+}
+
+// Matches the message against the first expected one that isn't
+// optional. Messages from stimuli within one scan of that may come
+// before it, optional ones skipped are dropped. A mismatch drops
+// the expected message as well, so one lost message doesn't make
+// all the following ones fail
+bool ikbd_ref::match(std::deque<expect> &q, const char *what, uint64_t t) {
+  size_t head = 0;
+  while(head < q.size() && q[head].optional) head++;
+
+  for(size_t i=0;i<q.size();i++) {
+    if(head < q.size() && q[i].time > q[head].time + SCAN_NS) break;
+
+    bool soft;
+    if(!matches(q[i], &soft)) continue;
+
+    // a key released and pressed again within a scan. The rom
+    // reports the release in between before it sees the key again
+    if(&q == &keys && q[i].optional && (q[i].bytes[0] & 0x80)) {
+      bool late = false;
+      for(size_t j=i+1;j<q.size();j++)
+	if(q[j].bytes[0] == (q[i].bytes[0] & 0x7f) && q[j].time + SCAN_NS < t)
+	  late = true;
+      if(late) continue;
+    }
+
+    // an optional message the same as the first one expected is
+    // taken as that, e.g. a key released and pressed again within
+    // a scan
+    if(q[i].optional && head < q.size() && q[head].bytes == q[i].bytes)
+      i = head;
+
+    if(soft) {
+      deviations++;
+      report(what, t, "deviation", &q[i].bytes);
+    } else
+      matched++;
+
+    if(q[i].pair > 0 && !(q[i].bytes[0] & 0x80))
+      pairs_seen.push_back(q[i].pair);
+    if(&q == &keys) key_reported(q[i], t);
+
+    // optional ones skipped a scan before were not reported
+    for(size_t j=i;j>0;j--)
+      if(q[j-1].optional && q[j-1].time + SCAN_NS < q[i].time && !key_may_follow(q, j - 1, t)) {
+	if(&q == &keys) key_dropped(q, j - 1);
+	q.erase(q.begin() + j - 1);
+	i--;
+      }
+    q.erase(q.begin() + i);
+    return true;
+  }
+
+  if(head < q.size()) {
+    mismatched++;
+    report(what, t, "MISMATCH", &q[head].bytes);
+    q.erase(q.begin(), q.begin() + head + 1);
+  } else {
+    unexpected++;
+    report(what, t, "UNEXPECTED", NULL);
+  }
+  return false;
+}
+
+// Which two of more keys pressed within one scan the rom reports
+// depends on their columns and when the scan passed them. If it
+// reported one held back here, that one takes the slot of a key
+// pressed within a scan of it which wasn't reported yet
+void ikbd_ref::key_swap(int code) {
+  for(size_t i=0;i<keys.size();i++)
+    if(keys[i].bytes[0] == code) return;
+
+  for(int c=0;c<15;c++)
+    for(int r=0;r<8;r++) {
+      if(!(matrix[c] & (1 << r)) || key_pair[c][r] || key_code(c, r) != code) continue;
+
+      for(size_t s=0;s<key_slots.size();s++) {
+	int sc = key_slots[s] >> 3, sr = key_slots[s] & 7, pair = key_pair[sc][sr];
+	uint64_t d = (key_time[sc][sr] > key_time[c][r])?key_time[sc][sr] - key_time[c][r]:
+	  key_time[c][r] - key_time[sc][sr];
+	bool seen = false;
+	for(size_t i=0;i<pairs_seen.size();i++)
+	  if(pairs_seen[i] == pair) seen = true;
+	if(d >= SCAN_NS || seen) continue;
+
+	for(size_t i=0;i<keys.size();i++)
+	  if(keys[i].pair == pair) {
+	    keys.erase(keys.begin() + i);
+	    break;
+	  }
+	key_pair[sc][sr] = 0;
+	key_slots.erase(key_slots.begin() + s);
+	key_make(c, r, key_time[c][r]);
+
+	// keep the queue in the order of the stimuli
+	for(size_t i=keys.size()-1;i>0 && keys[i-1].time > keys[i].time;i--)
+	  std::swap(keys[i-1], keys[i]);
+	return;
+      }
+    }
+}
+
+// a press matched. Within one scan the rom reports the keys in
+// column order, not in the order they were pressed
+void ikbd_ref::key_reported(const expect &e, uint64_t t) {
+  if(e.bytes[0] & 0x80) return;
+
+  keys_reported++;
+  for(size_t i=0;i<pairs_held.size();i++)
+    if(pairs_held[i] == e.pair)
+      pairs_held.erase(pairs_held.begin() + i--);
+  if(e.time < last_key_time) {
+    keys_reordered++;
+    fprintf(out, "@%.2fµs REF key %02x reordered: pressed %.2fms before %02x\n",
+	    t/1000.0, e.bytes[0], (last_key_time - e.time)/1000000.0, last_key_code);
+  } else {
+    last_key_time = e.time;
+    last_key_code = e.bytes[0];
+  }
+}
+
+// a press held back while a slot was freed is reported late if the
+// key is held for another scan, then within that scan
+bool ikbd_ref::key_may_follow(const std::deque<expect> &q, size_t i, uint64_t t) const {
+  if(&q != &keys || (q[i].bytes[0] & 0x80) || q[i].time + 2 * SCAN_NS < t) return false;
+
+  bool held = false;
+  for(size_t j=0;j<pairs_held.size();j++)
+    if(pairs_held[j] == q[i].pair) held = true;
+  if(!held) return false;
+
+  for(size_t j=i+1;j<q.size();j++)
+    if(q[j].pair == q[i].pair) return q[j].time >= q[i].time + SCAN_NS;
+  return true;
+}
+
+// an optional press was not reported, its release follows it in
+// the queue
+void ikbd_ref::key_dropped(const std::deque<expect> &q, size_t i) {
+  if(q[i].bytes[0] & 0x80) return;
+
+  bool held = false;
+  for(size_t j=0;j<pairs_held.size();j++)
+    if(pairs_held[j] == q[i].pair) {
+      pairs_held.erase(pairs_held.begin() + j);
+      held = true;
+      break;
+    }
+
+  for(size_t j=i+1;j<q.size();j++)
+    if(q[j].pair == q[i].pair && q[j].time < q[i].time + SCAN_NS) {
+      keys_short++;
+      fprintf(out, "@%.2fµs REF key %02x dropped: released after %.2fms, less than a scan\n",
+	      q[i].time/1000.0, q[i].bytes[0], (q[j].time - q[i].time)/1000000.0);
+      return;
+    }
+  if(held) {
+    keys_rollover++;
+    fprintf(out, "@%.2fµs REF key %02x not reported: pressed within a scan of the release of a key in a slot\n",
+	    q[i].time/1000.0, q[i].bytes[0]);
+    return;
+  }
+
+  keys_short++;
+  for(size_t j=i;j>0;j--)
+    if(q[j-1].bytes[0] == (q[i].bytes[0] | 0x80) && q[j-1].time + SCAN_NS > q[i].time) {
+      fprintf(out, "@%.2fµs REF key %02x dropped: pressed %.2fms after its release, less than a scan\n",
+	      q[i].time/1000.0, q[i].bytes[0], (q[i].time - q[j-1].time)/1000000.0);
+      return;
+    }
+  fprintf(out, "@%.2fµs REF key %02x dropped: pressed less than a scan\n",
+	  q[i].time/1000.0, q[i].bytes[0]);
+}
+
+// a complete message was received
+void ikbd_ref::check(uint64_t t) {
+  uint8_t h = msg[0];
+
+  if(joy_on && joy_mode == J_MONITOR) {
+    // both fire buttons and both directions, sampled every
+    // monitor_rate * 10ms. They are debounced independently
+    uint64_t from = t - (monitor_rate * 10 + 20) * 1000000ull;
+    int f = msg[0], d = msg[1];
+    if(history_has(0, 0x80, (f & 2)?0x80:0, from, t) && history_has(1, 0x80, (f & 1)?0x80:0, from, t) &&
+       history_has(0, JOY_DIRS, d >> 4, from, t) && history_has(1, JOY_DIRS, d & 0x0f, from, t))
+      matched++;
+    else {
+      mismatched++;
+      report("joystick monitor", t, "MISMATCH", NULL);
+    }
+    return;
+  }
+
+  if(joy_on && joy_mode == J_FIRE) {
+    // eight samples of joystick 1's fire button, the latest in bit 0
+    uint64_t from = t - 5000000ull;
+    int ok = 0;
+    if(h == 0x00) ok = history_has(1, 0x80, 0, from, t);
+    else if(h == 0xff) ok = history_has(1, 0x80, 0x80, from, t);
+    else
+      for(int k=1;k<8;k++)
+	if(h == ((0xff << k) & 0xff) || h == (~(0xff << k) & 0xff))
+	  ok = history_has(1, 0x80, 0, from, t) && history_has(1, 0x80, 0x80, from, t);
+    if(ok) matched++;
+    else {
+      mismatched++;
+      report("fire monitor", t, "MISMATCH", NULL);
+    }
+    return;
+  }
+
+  switch(h) {
+  case 0xf6: case 0xfc: case 0xfd:
+    match(replies, "reply", t);
+    return;
+
+  case 0xf7:
+    // interrogated or sent on a button event
+    if(!replies.empty() && replies.front().bytes[0] == 0xf7)
+      match(replies, "mouse position", t);
+    else
+      match(abs_events, "mouse button", t);
+    return;
+
+  case 0xf8: case 0xf9: case 0xfa: case 0xfb: {
+    rel_got[0] += (int8_t)msg[1];
+    rel_got[1] += (int8_t)msg[2];
+
+    // the buttons in the header have to follow the mouse
+    if((h & 3) == rel_header) return;
+    rel_header = h & 3;
+    match(rel_buttons, "mouse buttons", t);
+  } return;
+
+  case 0xfe: case 0xff: {
+    int p = h & 1;
+    if(!p && joy_reported[0] < 0) {
+      // port 0 shows the mouse's quadrature signals
+      unchecked++;
+      return;
+    }
+
+    match(joy_events[p], p?"joystick 1":"joystick 0", t);
+  } return;
+
+  case 0xf0: case 0xf1:
+    // the boot message or the release of keypad 0 or .
+    if(!replies.empty() && replies.front().bytes[0] == h) {
+      match(replies, "boot", t);
+      return;
+    }
+    break;
+  }
+
+  // key codes, those of the arrows may come from mouse keycode mode
+  for(int i=0;i<4;i++)
+    if(mouse_mode == M_KEY && (h & 0x7f) == rom[ROM_ARROWS - 0xf000 + i]) {
+      bool queued = false;
+      for(size_t j=0;j<keys.size();j++)
+	if(keys[j].bytes[0] == h) queued = true;
+      if(!queued) {
+	if(!(h & 0x80)) mkeys_got[i]++;
+	return;
+      }
+    }
+
+  if(!(h & 0x80)) key_swap(h);
+  match(keys, "key", t);
+}
+
+void ikbd_ref::rx(uint8_t b, uint64_t t) {
+  advance(t);
+  if(stopped) return;
+
+  if(!msg_len) {
+    msg.clear();
+    msg_time = t;
+    if(joy_on && joy_mode == J_MONITOR) msg_len = 2;
+    else if(joy_on && joy_mode == J_FIRE) msg_len = 1;
+    else switch(b) {
+      case 0xf6: msg_len = 8; break;
+      case 0xf7: msg_len = 6; break;
+      case 0xf8: case 0xf9: case 0xfa: case 0xfb: msg_len = 3; break;
+      case 0xfc: msg_len = 7; break;
+      case 0xfd: msg_len = 3; break;
+      case 0xfe: case 0xff: msg_len = 2; break;
+      default:   msg_len = 1; break;
+      }
+  }
+
+  msg.push_back(b);
+  if(msg.size() == msg_len) {
+    msg_len = 0;
+    check(msg_time);
+  }
+}
+
+// expected messages which are overdue. At the end of the simulation
+// those more recent than the timeout are ignored
+void ikbd_ref::expire(std::deque<expect> &q, const char *what, uint64_t t) {
+  for(size_t i=0;i<q.size();i++) {
+    if(q[i].time + TIMEOUT_NS > t) continue;
+    if(q[i].optional) {
+      if(&q == &keys) key_dropped(q, i);
+      continue;
+    }
+    missing++;
+    if(&q == &keys && !(q[i].bytes[0] & 0x80)) keys_missing++;
+    fprintf(out, "@%.2fµs REF %s MISSING: expected %s\n", q[i].time/1000.0, what,
+	    hex(q[i].bytes).c_str());
+  }
+}
+
+bool ikbd_ref::print(uint64_t t) {
+  advance(t);
+
+  // what was expected before the check stopped has to be there
+  uint64_t end = stopped?stop_time:t;
+  expire(keys, "key", end);
+  expire(replies, "reply", end);
+  expire(abs_events, "mouse button", end);
+  expire(rel_buttons, "mouse buttons", end);
+  expire(joy_events[0], "joystick 0", end);
+  expire(joy_events[1], "joystick 1", end);
+
+  fprintf(out, "Reference: %llu messages matched, %llu mismatched, %llu missing, %llu unexpected",
+	  (unsigned long long)matched, (unsigned long long)mismatched,
+	  (unsigned long long)missing, (unsigned long long)unexpected);
+  if(unchecked) fprintf(out, ", %llu unchecked", (unsigned long long)unchecked);
+  fprintf(out, "\n");
+
+  // the presses at the end may not be due yet
+  if(keys_typed) {
+    uint64_t pending = keys_typed - keys_reported - keys_short - keys_missing - keys_rollover;
+    fprintf(out, "  keys %llu typed, %llu reported, %llu shorter than a scan, %llu missing, "
+	    "%llu behind two held keys, %llu reordered",
+	    (unsigned long long)keys_typed, (unsigned long long)keys_reported,
+	    (unsigned long long)keys_short, (unsigned long long)keys_missing,
+	    (unsigned long long)keys_rollover, (unsigned long long)keys_reordered);
+    if(pending) fprintf(out, ", %llu not due yet", (unsigned long long)pending);
+    fprintf(out, "\n");
+  }
+
+  // the motion in total, less what is below the threshold
+  if(!stopped && (rel_expect[0] || rel_expect[1] || rel_got[0] || rel_got[1])) {
+    bool ok = !mouse_unsure && !pending[0] && !pending[1];
+    for(int i=0;i<2;i++)
+      if(labs(rel_expect[i] - rel_got[i]) >= threshold[i]) ok = false;
+    if(!ok) deviations++;
+    fprintf(out, "  relative mouse x %ld of %ld, y %ld of %ld%s\n",
+	    rel_got[0], rel_expect[0], rel_got[1], rel_expect[1],
+	    mouse_unsure?", joystick 0 moved the mouse":ok?"":": deviation");
+  }
+
+  int mk = 0;
+  for(int i=0;i<4;i++)
+    mk += mkeys_expect[i] + mkeys_got[i];
+  if(!stopped && mk) {
+    bool ok = true;
+    fprintf(out, "  mouse keys");
+    for(int i=0;i<4;i++) {
+      fprintf(out, " %s %d of %d", mkey_name[i], mkeys_got[i], mkeys_expect[i]);
+      if(mkeys_got[i] != mkeys_expect[i]) ok = false;
+    }
+    if(!ok) deviations++;
+    fprintf(out, "%s\n", ok?"":": deviation");
+  }
+
+  if(deviations)
+    fprintf(out, "  %llu deviations in mouse motion\n", (unsigned long long)deviations);
+  if(stopped)
+    fprintf(out, "  not checked after @%.2fµs: %s\n", stop_time/1000.0, stop_reason.c_str());
+
+  return !mismatched && !missing && !unexpected;
+}
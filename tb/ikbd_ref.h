@@ -0,0 +1,195 @@
+/*
+  ikbd_ref.h
+
+  Protocol level reference model of the ikbd and a comparator for
+  its output. It gets the same stimuli as the model under test, i.e.
+  the ps2 bytes as ps2.sv receives them, the joystick states and the
+  bytes sent to the ikbd, and predicts the messages the rom sends in
+  reply: key codes, relative, absolute and keycode mouse reports,
+  joystick events, interrogation, monitoring and fire button
+  monitoring, time of day, status reports and memory reads. The
+  details follow rom/IKBD.ASM, e.g. the key codes are taken from the
+  rom's own tables.
+
+  The bytes received from the ikbd are split into messages by their
+  header and checked against the prediction. Key codes, replies and
+  joystick events have to match exactly, only keys pressed for less
+  than one scan of the matrix may be missing and keys pressed within
+  the same scan may come in any order. Mouse motion is stepped out
+  by ps2.sv and the rom's quadrature decoding may lose steps when
+  the direction changes, so motion is only compared in total and a
+  difference is reported as a deviation, not as a failure.
+
+  What can't be predicted on this level, like code executed on the
+  ikbd or a byte lost by the sci, ends the check and is reported.
+*/
+
+#ifndef IKBD_REF_H
+#define IKBD_REF_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+// bytes of an expected message are 0-255, a byte that is only
+// compared as a deviation is or'ed with REF_SOFT
+#define REF_ANY   -1
+#define REF_SOFT  0x100
+
+class ikbd_ref {
+public:
+  ikbd_ref(FILE *out, const char *rom = "../rom/ikbd.hex", const char *keys = "../rom/keymap.hex");
+
+  // the ikbd was powered up at time t instead of being restored
+  // from a snapshot, it sends its boot message
+  void power_up(uint64_t t);
+
+  // stimuli as the ikbd sees them: a ps2 byte after its stop bit, a
+  // joystick pin change and a byte on rx at its stop bit
+  void ps2_byte(int dev, uint8_t b, uint64_t t);
+  void joystick(int port, uint8_t state, uint64_t t);
+  void command(uint8_t b, uint64_t t);
+
+  // a byte from the ikbd, t is the time of its start bit
+  void rx(uint8_t b, uint64_t t);
+
+  // nothing is checked after this, e.g. when the sci lost a byte
+  void stop(uint64_t t, const char *reason);
+
+  // messages that didn't match so far
+  uint64_t errors() const { return mismatched + missing + unexpected; }
+
+  // prints the summary, false if anything didn't match
+  bool print(uint64_t t);
+
+private:
+  FILE *out;
+  uint8_t rom[4096];      // $f000-$ffff
+  uint8_t keymap[512];
+  bool load(const char *rom_file, const char *keys_file);
+
+  // ========= expected messages =========
+  struct expect {
+    uint64_t time;        // of the stimulus or command
+    std::vector<int> bytes;
+    std::vector<int> alt; // accepted as well if not empty
+    bool optional;        // may be missing
+    int pair;             // key press and its release share this
+  };
+  std::deque<expect> keys, replies, abs_events, rel_buttons, joy_events[2];
+  std::vector<int> pairs_seen;
+  int pair_next;
+  int out_free;           // output buffer bytes left while paused
+
+  void emit(std::deque<expect> &q, uint64_t t, const std::vector<int> &bytes,
+	    int pair = 0, bool optional = false);
+  void reply(uint64_t t, const std::vector<int> &bytes, const std::vector<int> &alt = std::vector<int>());
+
+  // ========= the rom's state =========
+  enum { M_REL, M_ABS, M_KEY };
+  bool mouse_on, joy0_mode, y_bottom, paused;
+  int mouse_mode;
+  uint8_t button_action, threshold[2], scale[2], key_delta[2];
+  int abs_max[2], abs_pos[2];
+  uint8_t abs_buttons;    // $c2, button events since the last interrogation
+  bool abs_moved;         // the position depends on stepped motion
+
+  enum { J_EVENT, J_INTERROGATE, J_MONITOR, J_FIRE };
+  bool joy_on;
+  int joy_mode, monitor_rate;
+  int joy_reported[2];    // $a4/$a5
+
+  uint8_t tod[6];         // year, month, day, hour, minute, second
+  uint64_t tod_time;      // the seconds advance 1s after this
+
+  std::vector<uint8_t> cmd;
+  int load_addr, load_left;
+  uint64_t load_time, boot_until;
+  bool drop_next;
+
+  void reset(uint64_t t);
+  void execute(uint64_t t);
+  void resume();
+  void status(uint64_t t, int code, const uint8_t *p, int n);
+  void mouse_command(uint64_t t, int mode);
+  void joystick_command(uint64_t t, int mode);
+  void tod_now(uint64_t t, uint8_t *r);
+
+  // ========= stimuli =========
+  bool kbd_release, kbd_ext;
+  uint8_t matrix[15];
+  uint64_t key_time[15][8];
+  int key_pair[15][8];
+  std::vector<int> key_slots;   // reported keys other than modifiers
+  std::vector<uint64_t> key_freed;   // releases of keys in the slots
+  std::vector<int> pairs_held;   // presses the rom may hold back
+  int key_code(int col, int row) const;
+  void key_make(int col, int row, uint64_t t);
+  void key(int col, int row, bool down, uint64_t t);
+  void key_swap(int code);
+
+  // what became of the key presses: reported, shorter than a scan,
+  // missing, never reported because two other keys were held all
+  // the time, or reported after a key pressed later
+  uint64_t keys_typed, keys_reported, keys_short, keys_missing, keys_rollover, keys_reordered;
+  uint64_t last_key_time;   // stimulus of the latest press reported
+  int last_key_code;
+  void key_reported(const expect &e, uint64_t t);
+  void key_dropped(const std::deque<expect> &q, size_t i);
+  bool key_may_follow(const std::deque<expect> &q, size_t i, uint64_t t) const;
+
+  int mouse_state, mouse_sign, mouse_btn;   // like ps2.sv
+  int pending[2];         // steps ps2.sv still has to output
+  int quad[2];            // position of the quadrature signals
+  uint64_t step_time, settle_time;
+  bool mouse_active;      // the mouse and not joystick 0 drives port 0
+  uint8_t joy[2];
+  uint8_t buttons;        // mouse buttons as seen by the rom, $c0
+  bool mouse_unsure;      // motion checks are meaningless
+
+  long rel_expect[2], rel_got[2];
+  int key_acc[2];
+  int mkeys_expect[4], mkeys_got[4];
+
+  void mouse_packet_byte(uint8_t d, uint64_t t);
+  void mouse_steps(uint64_t t);
+  void mouse_step(int axis, int dir);
+  void buttons_update(uint64_t t);
+  void joy_update(uint64_t t);
+  void debounce(std::deque<expect> &q, uint64_t t);
+  int port_value(int port) const;
+  bool fire_line(int port) const;
+
+  // port states over time for the monitoring modes, -1 is unknown
+  struct sample {
+    uint64_t time;
+    int value;
+  };
+  std::deque<sample> history[2];
+  void history_add(int port, uint64_t t);
+  bool history_has(int port, int mask, int value, uint64_t from, uint64_t to) const;
+
+  // ========= comparison =========
+  std::vector<uint8_t> msg;
+  uint64_t msg_time;
+  size_t msg_len;
+  int rel_header;         // button bits of the last relative report
+
+  uint64_t matched, mismatched, missing, unexpected, deviations, unchecked;
+  bool stopped;
+  uint64_t stop_time;
+  std::string stop_reason;
+
+  void advance(uint64_t t);
+  void check(uint64_t t);
+  bool match(std::deque<expect> &q, const char *what, uint64_t t);
+  bool matches(const expect &e, bool *soft) const;
+  void report(const char *what, uint64_t t, const char *verdict, const std::vector<int> *exp);
+  void expire(std::deque<expect> &q, const char *what, uint64_t t);
+  std::string hex(const std::vector<uint8_t> &v) const;
+  std::string hex(const std::vector<int> &v) const;
+};
+
+#endif // IKBD_REF_H
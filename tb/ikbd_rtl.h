@@ -0,0 +1,85 @@
+/*
+  ikbd_rtl.h
+
+  The verilated ikbd.sv behind the common ikbd_model interface
+*/
+
+#ifndef IKBD_RTL_H
+#define IKBD_RTL_H
+
+#include "verilated.h"
+#include "Vikbd.h"
+#include "ikbd_model.h"
+
+// the model is verilated with --savable unless this is disabled,
+// e.g. for --threads which doesn't support it
+#ifndef VM_SAVABLE
+#define VM_SAVABLE 1
+#endif
+
+class ikbd_rtl : public ikbd_model {
+public:
+  // each instance runs in its own context, so several of them can
+  // be simulated in parallel threads
+  ikbd_rtl() { ctx = new VerilatedContext; top = new Vikbd(ctx); }
+  ~ikbd_rtl() { delete top; delete ctx; }
+
+  void eval() {
+    top->clk = clk;
+    top->res = res;
+    top->periph_en = periph_en;
+    top->ps2_kbd_clk = ps2_kbd_clk;
+    top->ps2_kbd_data = ps2_kbd_data;
+    top->ps2_mouse_clk = ps2_mouse_clk;
+    top->ps2_mouse_data = ps2_mouse_data;
+    top->rx = rx;
+    top->joystick0 = joystick0;
+    top->joystick1 = joystick1;
+    top->sci_tx_slots = sci_tx_slots;
+
+    top->eval();
+
+    tx = top->tx;
+    caps_lock = top->caps_lock;
+    joy_port_toggle = top->joy_port_toggle;
+
+    dbg_pc = top->dbg_pc;
+    dbg_a = top->dbg_a;
+    dbg_b = top->dbg_b;
+    dbg_cc = top->dbg_cc;
+    dbg_x = top->dbg_x;
+    dbg_sp = top->dbg_sp;
+    dbg_icnt = top->dbg_icnt;
+    dbg_opcode = top->dbg_opcode;
+    dbg_trcsr = top->dbg_trcsr;
+    dbg_rmcr = top->dbg_rmcr;
+    dbg_po2 = top->dbg_po2;
+    dbg_po3 = top->dbg_po3;
+    dbg_po4 = top->dbg_po4;
+    dbg_mouse = top->dbg_mouse;
+  }
+
+  const char *name() const { return "rtl"; }
+
+  // needs the model to be verilated with --savable
+  bool savable() const { return VM_SAVABLE; }
+
+  void save(VerilatedSerialize &os) {
+    ikbd_model::save(os);
+#if VM_SAVABLE
+    os << *top;
+#endif
+  }
+
+  void restore(VerilatedDeserialize &os) {
+    ikbd_model::restore(os);
+#if VM_SAVABLE
+    os >> *top;
+#endif
+  }
+
+  VerilatedContext *ctx;
+  Vikbd *top;
+};
+
+#endif // IKBD_RTL_H
@@ -0,0 +1,594 @@
+/*
+  ikbd_sim.cpp
+
+  C++ model of ikbd.sv and ps2.sv, see ikbd_sim.h
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ikbd_sim.h"
+
+// keymap entries, see rom/keymap.hex
+#define KEY_VALID    0x80
+#define KEY_ROW(k)   (((k) >> 3) & 15)
+#define KEY_COL(k)   ((k) & 7)
+#define KEY_TOGGLE   15      // row 15 toggles joy_port_toggle
+
+// mouse motion not yet output and quadrature step rate, see ps2.sv
+#define MOUSE_MAX     1023
+#define MOUSE_PERIOD  1280
+
+// heads of the rom's main loop, see rom/IKBD.ASM
+#define FF_HEAD1      0xf13a
+#define FF_HEAD2      0xf150
+
+// longest iteration recorded in instructions and the number of
+// iterations cached before the cache is flushed
+#define FF_MAX_SNAPS  1024
+#define FF_MAX_ITERS  512
+
+ikbd_sim::ikbd_sim(const char *rom, const char *keys) :
+  ff_on(false), ff_icnt(0), ff_head_icnt(0), ff_cycles(0), ff_pins(0), ff_outputs(0),
+  ff_rec(NULL), ff_hit(NULL), ff_iters(0) {
+  cpu.load_rom(rom);
+  load_keymap(keys);
+  last_clk = 0;
+  reset();
+  update_outputs();
+}
+
+ikbd_sim::~ikbd_sim() {
+  ff_drop();
+  ff_clear();
+}
+
+// same format as the rom but with // comments which $readmemh
+// skips as well
+bool ikbd_sim::load_keymap(const char *name) {
+  memset(keymap, 0, sizeof(keymap));
+
+  FILE *f = fopen(name, "r");
+  if(!f) {
+    fprintf(stderr, "Unable to open keymap %s\n", name);
+    return false;
+  }
+
+  char line[256];
+  unsigned int n = 0;
+  while(n < sizeof(keymap) && fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "/")] = 0;
+    for(char *t = strtok(line, " \t\r\n"); t && n < sizeof(keymap); t = strtok(NULL, " \t\r\n"))
+      keymap[n++] = strtoul(t, NULL, 16);
+  }
+
+  fclose(f);
+  return n == sizeof(keymap);
+}
+
+void ikbd_sim::reset() {
+  kbd_last_clk = 1;
+  kbd_bit_cnt = 0;
+  kbd_sr = 0;
+  kbd_parity = 0;
+  kbd_release = 0;
+  kbd_ext = 0;
+  joy_port_toggle = 0;
+  mouse_z_up_d = 0;
+  mouse_z_down_d = 0;
+  memset(matrix, 0xff, sizeof(matrix));
+
+  mouse_last_clk = 1;
+  mouse_bit_cnt = 0;
+  mouse_sr = 0;
+  mouse_parity = 0;
+  mouse_state = 0;
+  mouse_sign = 0;
+  mouse_btn = 0;
+  mouse_x = mouse_y = mouse_z = 0;
+  mouse_x_cnt = mouse_y_cnt = 0;
+  mouse_ev_cnt = 0;
+  mouse_step_cnt = 0;
+  mouse_z_up = mouse_z_down = 0;
+
+  last_joystick0 = joystick0;
+  last_mouse_atari = mouse_atari();
+  mouse_active = 1;
+
+  // P20-P22 select mode 7 when coming out of reset
+  cpu.pi2 = 0x1f;
+  cpu.reset();
+  ff_drop();
+  ff_icnt = cpu.icnt;
+}
+
+void ikbd_sim::kbd_decode(uint8_t code) {
+  if(code == 0xf0) {
+    kbd_release = 1;
+    return;
+  }
+
+  if(code == 0xe0) {
+    kbd_ext = 1;
+    return;
+  }
+
+  uint8_t k = keymap[(kbd_ext << 8) | code];
+  if(k & KEY_VALID) {
+    if(KEY_ROW(k) == KEY_TOGGLE) {
+      if(kbd_release) joy_port_toggle = !joy_port_toggle;
+    } else if(kbd_release) matrix[KEY_ROW(k)] |=  (1<<KEY_COL(k));
+    else                   matrix[KEY_ROW(k)] &= ~(1<<KEY_COL(k));
+  }
+
+  kbd_release = 0;
+  kbd_ext = 0;
+}
+
+void ikbd_sim::kbd_clock() {
+  // mouse wheel keyboard emulation
+  if(mouse_z_up ^ mouse_z_up_d)
+    matrix[12] = (matrix[12] & ~0x02) | (mouse_z_up?0:0x02);
+  if(mouse_z_down ^ mouse_z_down_d)
+    matrix[12] = (matrix[12] & ~0x10) | (mouse_z_down?0:0x10);
+  mouse_z_up_d = mouse_z_up;
+  mouse_z_down_d = mouse_z_down;
+
+  uint8_t falling = !ps2_kbd_clk && kbd_last_clk;
+  kbd_last_clk = ps2_kbd_clk;
+  if(!falling) return;
+
+  if(!kbd_bit_cnt) {
+    // wait for start bit
+    kbd_parity = 0;
+    if(!ps2_kbd_data)
+      kbd_bit_cnt++;
+  } else if(kbd_bit_cnt < 10) {
+    // shift in data and parity
+    kbd_bit_cnt++;
+    kbd_sr = (ps2_kbd_data?0x100:0) | (kbd_sr >> 1);
+    kbd_parity ^= ps2_kbd_data;
+  } else if(ps2_kbd_data) {
+    if(kbd_parity)
+      kbd_decode(kbd_sr & 0xff);
+    kbd_bit_cnt = 0;
+  }
+}
+
+// the motion not yet output is kept as 11 bit two's complement
+// like in ps2.sv and saturates at +/-MOUSE_MAX
+static int mouse_value(uint16_t v) {
+  return (v & 0x400)?(int)v - 0x800:v;
+}
+
+static uint16_t mouse_add(uint16_t v, int d) {
+  int r = mouse_value(v) + d;
+  if(r >  MOUSE_MAX) r =  MOUSE_MAX;
+  if(r < -MOUSE_MAX) r = -MOUSE_MAX;
+  return r & 0x7ff;
+}
+
+void ikbd_sim::mouse_clock() {
+  // generate atari st like mouse pulses at clk/MOUSE_PERIOD
+  int x = mouse_value(mouse_x), y = mouse_value(mouse_y);
+
+  if(!mouse_step_cnt) {
+    if(x < 0) {
+      mouse_x = mouse_add(mouse_x, 1);
+      mouse_x_cnt = ((mouse_x_cnt & 1) << 1) | (~mouse_x_cnt >> 1 & 1);
+    } else if(x > 0) {
+      mouse_x = mouse_add(mouse_x, -1);
+      mouse_x_cnt = ((~mouse_x_cnt & 1) << 1) | (mouse_x_cnt >> 1 & 1);
+    }
+
+    if(y < 0) {
+      mouse_y = mouse_add(mouse_y, 1);
+      mouse_y_cnt = ((mouse_y_cnt & 1) << 1) | (~mouse_y_cnt >> 1 & 1);
+    } else if(y > 0) {
+      mouse_y = mouse_add(mouse_y, -1);
+      mouse_y_cnt = ((~mouse_y_cnt & 1) << 1) | (mouse_y_cnt >> 1 & 1);
+    }
+  }
+
+  // the wheel isn't polled by the rom and steps at clk/1024
+  if(!mouse_ev_cnt) {
+    if(mouse_z & 0x100) {
+      mouse_z = (mouse_z + 1) & 0x1ff;
+      mouse_z_up = 1;
+    } else if(mouse_z) {
+      mouse_z--;
+      mouse_z_down = 1;
+    } else {
+      mouse_z_up = 0;
+      mouse_z_down = 0;
+    }
+  }
+  mouse_ev_cnt = (mouse_ev_cnt + 1) & 0x3ff;
+  mouse_step_cnt = (mouse_step_cnt + 1 == MOUSE_PERIOD)?0:mouse_step_cnt + 1;
+
+  uint8_t falling = !ps2_mouse_clk && mouse_last_clk;
+  mouse_last_clk = ps2_mouse_clk;
+  if(!falling) return;
+
+  if(!mouse_bit_cnt) {
+    mouse_parity = 0;
+    if(!ps2_mouse_data)
+      mouse_bit_cnt++;
+  } else if(mouse_bit_cnt < 10) {
+    mouse_bit_cnt++;
+    mouse_sr = (ps2_mouse_data?0x100:0) | (mouse_sr >> 1);
+    mouse_parity ^= ps2_mouse_data;
+  } else if(ps2_mouse_data) {
+    if(mouse_parity) {
+      uint8_t d = mouse_sr & 0xff;
+      switch(mouse_state) {
+      case 0:
+	if(d & 0x08) {
+	  mouse_btn = d & 3;
+	  mouse_sign = (d >> 4) & 3;
+	  mouse_state = 1;
+	}
+	break;
+      case 1:
+	// sign extended 9 bit movement adds to what's left
+	mouse_x = mouse_add(mouse_x, (mouse_sign & 1)?d - 0x100:d);
+	mouse_state = 2;
+	break;
+      case 2:
+	// ps2 y is upwards, atari y downwards
+	mouse_y = mouse_add(mouse_y, (mouse_sign & 2)?0x100 - d:-d);
+	mouse_state = 3;
+	break;
+      default:
+	mouse_z = (((~d + 1) & 0x1f) << 4);
+	mouse_state = 0;
+	break;
+      }
+    }
+    mouse_bit_cnt = 0;
+  }
+}
+
+uint8_t ikbd_sim::matrix_out() const {
+  uint16_t cols = ((cpu.po4() << 7) | (cpu.po3() >> 1)) & 0x7fff;
+  uint8_t r = 0xff;
+
+  for(int i=0;i<15;i++)
+    if(!(cols & (1<<i)))
+      r &= matrix[i];
+
+  return r;
+}
+
+void ikbd_sim::update_outputs() {
+  uint8_t po2 = cpu.po2();
+
+  tx = (po2 >> 4) & 1;
+  caps_lock = cpu.po3() & 1;
+
+  dbg_pc = cpu.ipc;
+  dbg_a = cpu.ia;
+  dbg_b = cpu.ib;
+  dbg_cc = cpu.icc;
+  dbg_x = cpu.ix;
+  dbg_sp = cpu.isp;
+  dbg_icnt = cpu.icnt;
+  dbg_opcode = cpu.iop;
+  dbg_trcsr = cpu.trcsr_o();
+  dbg_rmcr = cpu.rmcr;
+  dbg_po2 = po2;
+  dbg_po3 = cpu.po3();
+  dbg_po4 = cpu.po4();
+  dbg_mouse = mouse_atari();
+}
+
+void ikbd_sim::clock() {
+  // switch between mouse and joystick
+  uint8_t ma = mouse_atari();
+  uint8_t mouse_joy = mouse_active?ma:joystick0;
+
+  if(last_mouse_atari != ma) {
+    last_mouse_atari = ma;
+    mouse_active = 1;
+  } else if(last_joystick0 != joystick0) {
+    last_joystick0 = joystick0;
+    mouse_active = 0;
+  }
+
+  // the 74ls244 and the fire buttons
+  uint8_t po2 = cpu.po2();
+  uint8_t fire = (((mouse_joy >> 5) | (joystick1 >> 4)) & 1) << 1 | ((mouse_joy >> 4) & 1);
+
+  cpu.pi4 = (po2 & 1)?0xff:~(((joystick1 & 0x0f) << 4) | (mouse_joy & 0x0f));
+  cpu.pi2 = (po2 & 0x10) | (rx?0x08:0) | ((~fire & 3) << 1) | (po2 & 1);
+  cpu.pi1 = matrix_out();
+  cpu.tx_slots = sci_tx_slots;
+
+  cpu.clock(periph_en);
+
+  if(periph_en) {
+    kbd_clock();
+    mouse_clock();
+  }
+
+  if(ff_on) ff_clock();
+}
+
+void ikbd_sim::eval() {
+  if(clk && !last_clk) {
+    if(res) reset();
+    else    clock();
+  }
+  last_clk = clk;
+
+  update_outputs();
+}
+
+void ikbd_sim::save(VerilatedSerialize &os) {
+  ikbd_model::save(os);
+  cpu.save(os);
+  os.write(matrix, sizeof(matrix));
+  os << last_clk
+     << kbd_last_clk << kbd_bit_cnt << kbd_parity << kbd_sr << kbd_release << kbd_ext
+     << mouse_last_clk << mouse_bit_cnt << mouse_parity << mouse_sr
+     << mouse_state << mouse_sign << mouse_btn << mouse_x << mouse_y << mouse_z
+     << mouse_x_cnt << mouse_y_cnt << mouse_z_up << mouse_z_down
+     << mouse_z_up_d << mouse_z_down_d << mouse_ev_cnt << mouse_step_cnt
+     << mouse_active << last_joystick0 << last_mouse_atari;
+}
+
+void ikbd_sim::restore(VerilatedDeserialize &os) {
+  ikbd_model::restore(os);
+  cpu.restore(os);
+  os.read(matrix, sizeof(matrix));
+  os >> last_clk
+     >> kbd_last_clk >> kbd_bit_cnt >> kbd_parity >> kbd_sr >> kbd_release >> kbd_ext
+     >> mouse_last_clk >> mouse_bit_cnt >> mouse_parity >> mouse_sr
+     >> mouse_state >> mouse_sign >> mouse_btn >> mouse_x >> mouse_y >> mouse_z
+     >> mouse_x_cnt >> mouse_y_cnt >> mouse_z_up >> mouse_z_down
+     >> mouse_z_up_d >> mouse_z_down_d >> mouse_ev_cnt >> mouse_step_cnt
+     >> mouse_active >> last_joystick0 >> last_mouse_atari;
+  ff_drop();
+  ff_icnt = cpu.icnt;
+}
+
+// ========== fast forward ==========
+//
+// Most of the time the rom just spins in its main loop polling the
+// keyboard matrix, the joysticks and its command buffer. Each time
+// the loop passes one of its heads with the sci and the ps2 decoders
+// idle, the iteration starting there is recorded as the cpu state
+// after each instruction. It depends on nothing but the cpu state,
+// the inputs and the ram bytes it reads before writing them, as long
+// as it doesn't touch the timer or the sci and isn't interrupted.
+// When the same iteration comes along again it is replayed in one go
+// by restoring the state the cpu had after its last instruction that
+// fits in front of the next event of the testbench and the next
+// output compare. The timer, the sci bit timers and the mouse step
+// counters are simply advanced by the number of cycles skipped, so
+// the time of day interrupt and the sci timing stay cycle exact.
+
+void ikbd_sim::ff_drop() {
+  delete ff_rec;
+  ff_rec = NULL;
+  ff_hit = NULL;
+  cpu.track = false;
+}
+
+void ikbd_sim::ff_clear() {
+  for(auto &b : ff_cache)
+    for(ff_iter *it : b.second)
+      delete it;
+  ff_cache.clear();
+  ff_iters = 0;
+}
+
+// nothing but the cpu changes: no sci transfer or sci interrupt,
+// no pending compare interrupt, no ps2 transfer and no mouse motion
+bool ikbd_sim::ff_quiet() const {
+  if(res || periph_en != 1 || cpu.sleeping || cpu.wai_pushed)
+    return false;
+  if(cpu.oci && cpu.oce)
+    return false;
+
+  uint16_t last = cpu.bit_period() - 1;
+  if(cpu.rxcnt > last || cpu.txcnt > last)
+    return false;
+  if((cpu.trcsr & 0x08) && (cpu.rxsr != 0x1ff || !cpu.last_rx || !rx))
+    return false;
+  if(cpu.rdrf || cpu.orfe || cpu.txsr || !cpu.tdre || cpu.tdr_delay || (cpu.trcsr & 0x04))
+    return false;
+
+  if(kbd_bit_cnt || mouse_bit_cnt || kbd_last_clk != ps2_kbd_clk || mouse_last_clk != ps2_mouse_clk)
+    return false;
+  if(mouse_x || mouse_y || mouse_z || mouse_z_up || mouse_z_down || mouse_z_up_d || mouse_z_down_d)
+    return false;
+  return last_mouse_atari == mouse_atari() && last_joystick0 == joystick0;
+}
+
+// everything but the ram an iteration may depend on
+std::string ikbd_sim::ff_key() const {
+  ff_snap s;
+  ff_snapshot(s);
+
+  uint8_t k[sizeof(ff_cpu) + 15 + 12];
+  uint8_t *p = k;
+  memcpy(p, &s.cpu, sizeof(ff_cpu)); p += sizeof(ff_cpu);
+  memcpy(p, matrix, 15); p += 15;
+  uint32_t pins = ff_pin_state();
+  memcpy(p, &pins, 4); p += 4;
+  *p++ = mouse_btn;
+  *p++ = mouse_x_cnt;
+  *p++ = mouse_y_cnt;
+  *p++ = mouse_active;
+  *p++ = joy_port_toggle;
+  *p++ = sci_tx_slots;
+  *p++ = cpu.trcsr;
+  *p++ = cpu.txd;
+  return std::string((const char*)k, sizeof(k));
+}
+
+void ikbd_sim::ff_snapshot(ff_snap &s) const {
+  ff_cpu &c = s.cpu;
+  // the padding is part of the key
+  memset(&c, 0, sizeof(c));
+  c.a = cpu.a; c.b = cpu.b; c.cc = cpu.cc;
+  c.x = cpu.x; c.sp = cpu.sp; c.pc = cpu.pc;
+  c.ia = cpu.ia; c.ib = cpu.ib; c.icc = cpu.icc;
+  c.ipc = cpu.ipc; c.ix = cpu.ix; c.isp = cpu.isp;
+  c.iop = cpu.iop; c.phase = cpu.phase; c.busy = cpu.busy;
+  c.ddr[0] = cpu.ddr1; c.ddr[1] = cpu.ddr2; c.ddr[2] = cpu.ddr3; c.ddr[3] = cpu.ddr4;
+  c.por[0] = cpu.por1; c.por[1] = cpu.por2; c.por[2] = cpu.por3; c.por[3] = cpu.por4;
+  c.mode = cpu.mode;
+  c.pi1 = cpu.pi1; c.pi2 = cpu.pi2; c.pi4 = cpu.pi4;
+
+  s.cycles = ff_cycles;
+  s.icnt = cpu.icnt - ff_head_icnt;
+  s.wr[0] = cpu.ram_wr[0];
+  s.wr[1] = cpu.ram_wr[1];
+  memcpy(s.ram, cpu.ram, sizeof(s.ram));
+}
+
+void ikbd_sim::ff_apply(const ff_snap &s) {
+  const ff_cpu &c = s.cpu;
+  cpu.a = c.a; cpu.b = c.b; cpu.cc = c.cc;
+  cpu.x = c.x; cpu.sp = c.sp; cpu.pc = c.pc;
+  cpu.ia = c.ia; cpu.ib = c.ib; cpu.icc = c.icc;
+  cpu.ipc = c.ipc; cpu.ix = c.ix; cpu.isp = c.isp;
+  cpu.iop = c.iop; cpu.phase = c.phase; cpu.busy = c.busy;
+  cpu.ddr1 = c.ddr[0]; cpu.ddr2 = c.ddr[1]; cpu.ddr3 = c.ddr[2]; cpu.ddr4 = c.ddr[3];
+  cpu.por1 = c.por[0]; cpu.por2 = c.por[1]; cpu.por3 = c.por[2]; cpu.por4 = c.por[3];
+  cpu.pi1 = c.pi1; cpu.pi2 = c.pi2; cpu.pi4 = c.pi4;
+  cpu.icnt += s.icnt;
+
+  for(int i=0;i<128;i++)
+    if((s.wr[i>>6] >> (i&63)) & 1)
+      cpu.ram[i] = s.ram[i];
+}
+
+// what n cycles do to the timer, the idle sci and the mouse
+void ikbd_sim::ff_advance(uint32_t n) {
+  cpu.frc = (cpu.frc + n) & 0x1ffff;
+
+  uint32_t period = cpu.bit_period();
+  if(cpu.trcsr & 0x08)
+    cpu.rxcnt = (cpu.rxcnt + n) % period;
+  uint32_t tx = cpu.txcnt + n;
+  cpu.txcnt = tx % period;
+  cpu.txslot = (cpu.txslot + tx / period) % 11;
+
+  mouse_ev_cnt = (mouse_ev_cnt + n) & 0x3ff;
+  mouse_step_cnt = (mouse_step_cnt + n) % MOUSE_PERIOD;
+}
+
+// called after each clock once fast forward is in use
+void ikbd_sim::ff_clock() {
+  ff_hit = NULL;
+
+  if(ff_rec) {
+    ff_cycles++;
+    if(cpu.touched || ff_pin_state() != ff_pins || ff_output_state() != ff_outputs || !ff_quiet())
+      ff_drop();
+  }
+
+  if(cpu.icnt == ff_icnt) return;
+  ff_icnt = cpu.icnt;
+
+  if(cpu.ipc == FF_HEAD1 || cpu.ipc == FF_HEAD2) {
+    ff_head();
+    return;
+  }
+
+  if(ff_rec) {
+    if(ff_rec->snaps.size() >= FF_MAX_SNAPS) {
+      ff_drop();
+      return;
+    }
+    ff_rec->snaps.emplace_back();
+    ff_snapshot(ff_rec->snaps.back());
+  }
+}
+
+// the cpu just executed the first instruction of an iteration
+void ikbd_sim::ff_head() {
+  if(ff_rec) {
+    ff_rec->snaps.emplace_back();
+    ff_snapshot(ff_rec->snaps.back());
+    ff_rec->rd[0] = cpu.ram_rd[0];
+    ff_rec->rd[1] = cpu.ram_rd[1];
+    ff_cache[ff_rec_key].push_back(ff_rec);
+    ff_iters++;
+    ff_rec = NULL;
+    cpu.track = false;
+  }
+
+  if(!ff_quiet()) return;
+
+  ff_pins = ff_pin_state();
+  ff_outputs = ff_output_state();
+
+  std::string key = ff_key();
+  auto b = ff_cache.find(key);
+  if(b != ff_cache.end()) {
+    for(const ff_iter *it : b->second) {
+      int i;
+      for(i=0;i<128;i++)
+	if(((it->rd[i>>6] >> (i&63)) & 1) && it->ram[i] != cpu.ram[i])
+	  break;
+      if(i == 128) {
+	ff_hit = it;
+	return;
+      }
+    }
+  }
+
+  // not seen yet, record it
+  if(ff_iters >= FF_MAX_ITERS)
+    ff_clear();
+
+  ff_rec = new ff_iter;
+  ff_rec_key = key;
+  memcpy(ff_rec->ram, cpu.ram, sizeof(ff_rec->ram));
+  ff_head_icnt = cpu.icnt;
+  ff_cycles = 0;
+  cpu.clear_track();
+  cpu.track = true;
+}
+
+uint64_t ikbd_sim::fast_forward(uint64_t max_cycles) {
+  // the iterations are only recorded once this is in use
+  if(!ff_on) {
+    ff_on = true;
+    ff_icnt = cpu.icnt;
+    return 0;
+  }
+
+  uint64_t done = 0;
+  while(ff_hit && ff_pin_state() == ff_pins && ff_quiet()) {
+    // stay in front of the next output compare, the frc passes
+    // 2*ocr and 2*ocr+1 where it matches
+    uint32_t d = ((cpu.ocr << 1) - cpu.frc) & 0x1ffff;
+    uint64_t room = max_cycles - done;
+    if(!d) break;
+    if(d - 1 < room) room = d - 1;
+
+    const std::vector<ff_snap> &sn = ff_hit->snaps;
+    size_t j = sn.size();
+    while(j && sn[j-1].cycles > room) j--;
+    if(!j) break;
+
+    const ff_snap &s = sn[j-1];
+    ff_hit = NULL;
+    ff_advance(s.cycles);
+    ff_apply(s);
+    ff_icnt = cpu.icnt;
+    done += s.cycles;
+
+    // arrived at the next head, which may be cached as well
+    if(j == sn.size())
+      ff_head();
+  }
+
+  if(done) update_outputs();
+  return done;
+}
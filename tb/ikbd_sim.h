@@ -0,0 +1,125 @@
+/*
+  ikbd_sim.h
+
+  C++ model of the complete ikbd.sv incl. the ps2.sv keyboard and
+  mouse decoding, built around the instruction level hd6301 model.
+  It is a drop-in replacement for the verilated Vikbd and runs
+  considerably faster.
+*/
+
+#ifndef IKBD_SIM_H
+#define IKBD_SIM_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "ikbd_model.h"
+#include "hd6301.h"
+
+class ikbd_sim : public ikbd_model {
+public:
+  ikbd_sim(const char *rom = "../rom/ikbd.hex", const char *keys = "../rom/keymap.hex");
+  ~ikbd_sim();
+
+  void eval();
+  const char *name() const { return "sim"; }
+
+  void save(VerilatedSerialize &os);
+  void restore(VerilatedDeserialize &os);
+
+  // replays main loop iterations seen before with the same inputs
+  // and state instead of executing them again, see ikbd_sim.cpp
+  uint64_t fast_forward(uint64_t max_cycles);
+
+  hd6301 cpu;
+
+  // keyboard matrix as generated by ps2.sv
+  uint8_t matrix[15];
+
+  // ps2 code incl. the 0xe0 prefix to matrix position
+  uint8_t keymap[512];
+
+private:
+  void reset();
+  void clock();
+  void kbd_clock();
+  void mouse_clock();
+  void kbd_decode(uint8_t code);
+  bool load_keymap(const char *name);
+  uint8_t matrix_out() const;
+  void update_outputs();
+
+  uint8_t last_clk;
+
+  // ps2 keyboard decoding
+  uint8_t kbd_last_clk, kbd_bit_cnt, kbd_parity;
+  uint16_t kbd_sr;
+  uint8_t kbd_release, kbd_ext;
+
+  // ps2 mouse decoding and atari mouse signal generation
+  uint8_t mouse_last_clk, mouse_bit_cnt, mouse_parity;
+  uint16_t mouse_sr;
+  uint8_t mouse_state, mouse_sign, mouse_btn;
+  uint16_t mouse_x, mouse_y, mouse_z;    // x/y: motion left, 11 bit signed
+  uint8_t mouse_x_cnt, mouse_y_cnt;
+  uint8_t mouse_z_up, mouse_z_down, mouse_z_up_d, mouse_z_down_d;
+  uint16_t mouse_ev_cnt, mouse_step_cnt;
+
+  // mouse/joystick0 switching
+  uint8_t mouse_active, last_joystick0, last_mouse_atari;
+
+  uint8_t mouse_atari() const {
+    return (mouse_btn << 4) | (mouse_y_cnt << 2) | mouse_x_cnt; }
+
+  // fast forward. The cpu state an instruction of the main loop may
+  // change, the timer and the sci are advanced separately
+  struct ff_cpu {
+    uint8_t a, b, cc, ia, ib, icc, iop, phase;
+    uint16_t x, sp, pc, ipc, ix, isp;
+    int busy;
+    uint8_t ddr[4], por[4], mode, pi1, pi2, pi4;
+  };
+
+  // the state after each instruction of an iteration, the last one
+  // is the head of the next iteration
+  struct ff_snap {
+    uint32_t cycles, icnt;      // since the head
+    uint64_t wr[2];             // ram bytes written so far
+    ff_cpu cpu;
+    uint8_t ram[128];
+  };
+
+  // an iteration applies if the ram bytes it read before writing
+  // them had the same values
+  struct ff_iter {
+    uint64_t rd[2];
+    uint8_t ram[128];
+    std::vector<ff_snap> snaps;
+  };
+
+  bool ff_on;
+  uint32_t ff_icnt, ff_head_icnt, ff_cycles;
+  uint32_t ff_pins, ff_outputs;  // at the head
+  ff_iter *ff_rec;               // iteration being recorded or NULL
+  std::string ff_rec_key;
+  const ff_iter *ff_hit;         // cached iteration starting right here
+  std::unordered_map<std::string, std::vector<ff_iter*> > ff_cache;
+  size_t ff_iters;
+
+  void ff_clock();
+  void ff_head();
+  void ff_snapshot(ff_snap &s) const;
+  void ff_apply(const ff_snap &s);
+  void ff_advance(uint32_t n);
+  void ff_drop();
+  void ff_clear();
+  bool ff_quiet() const;
+  std::string ff_key() const;
+  uint32_t ff_pin_state() const {
+    return (res << 23) | (periph_en << 22) | (ps2_kbd_clk << 21) | (ps2_kbd_data << 20) |
+      (ps2_mouse_clk << 19) | (ps2_mouse_data << 18) | (rx << 17) | (joystick1 << 8) | joystick0; }
+  uint32_t ff_output_state() const {
+    return (cpu.po2() & 0x10) | ((cpu.po3() & 1) << 1) | joy_port_toggle; }
+};
+
+#endif // IKBD_SIM_H
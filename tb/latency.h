@@ -0,0 +1,100 @@
+/*
+  latency.h
+
+  Measures the time from an input event to the ikbd's report of it.
+  The testbench tags the stimuli when they are complete on the ikbd's
+  pins, i.e. a ps2 byte after its stop bit or a joystick pin change,
+  and the report's time is that of the start bit of its first byte
+  on tx.
+
+  Keys are matched one by one as every key event causes one report.
+  The same goes for the sci transmitter, measured from the write to
+  TDR up to the byte's start bit.
+  A mouse or joystick report covers all movement since the previous
+  one, so it matches all stimuli still waiting. Stimuli not reported
+  within LATENCY_TIMEOUT are counted as unreported.
+*/
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#define LAT_KEY    0
+#define LAT_MOUSE  1
+#define LAT_JOY    2
+#define LAT_TX     3
+#define LAT_TYPES  4
+
+#define LATENCY_TIMEOUT  100000000ull   // 100ms in ns
+
+class latency {
+public:
+  latency() { for(int i=0;i<LAT_TYPES;i++) unreported[i] = 0; }
+
+  void stimulus(int type, uint64_t time) {
+    expire(type, time);
+    pending[type].push_back(time);
+  }
+
+  void report(int type, uint64_t time) {
+    expire(type, time);
+    while(!pending[type].empty()) {
+      samples[type].push_back(time - pending[type].front());
+      pending[type].pop_front();
+      if(type == LAT_KEY || type == LAT_TX) break;
+    }
+  }
+
+  // stimuli still waiting for less than the timeout at the end of
+  // the simulation are ignored
+  void print(FILE *out, uint64_t time) {
+    static const char *name[LAT_TYPES] = { "keyboard", "mouse", "joystick", "sci tx" };
+    bool header = false;
+
+    for(int i=0;i<LAT_TYPES;i++) {
+      expire(i, time);
+      if(samples[i].empty() && !unreported[i])
+	continue;
+
+      if(!header) {
+	fprintf(out, "Latency (µs)  events       min       p50       p99       max  unreported\n");
+	header = true;
+      }
+
+      std::vector<uint64_t> &s = samples[i];
+      std::sort(s.begin(), s.end());
+      if(s.empty())
+	fprintf(out, "  %-10s %7d %9s %9s %9s %9s  %10llu\n", name[i], 0, "-", "-", "-", "-",
+		(unsigned long long)unreported[i]);
+      else
+	fprintf(out, "  %-10s %7zu %9.2f %9.2f %9.2f %9.2f  %10llu\n", name[i], s.size(),
+		s.front()/1000.0, percentile(s, 50)/1000.0, percentile(s, 99)/1000.0,
+		s.back()/1000.0, (unsigned long long)unreported[i]);
+    }
+  }
+
+private:
+  std::deque<uint64_t> pending[LAT_TYPES];
+  std::vector<uint64_t> samples[LAT_TYPES];
+  uint64_t unreported[LAT_TYPES];
+
+  void expire(int type, uint64_t time) {
+    while(!pending[type].empty() && time - pending[type].front() > LATENCY_TIMEOUT) {
+      pending[type].pop_front();
+      unreported[type]++;
+    }
+  }
+
+  // nearest rank
+  static uint64_t percentile(const std::vector<uint64_t> &s, int p) {
+    size_t r = (s.size() * p + 99) / 100;
+    return s[r?r-1:0];
+  }
+};
+
+#endif // LATENCY_H
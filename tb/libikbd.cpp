@@ -0,0 +1,254 @@
+/*
+  libikbd.cpp
+
+  The models behind the C interface of libikbd.h. This runs the same
+  transactors as the testbench but without a scenario, the inputs
+  come from the host and the time only advances in ikbd_step()
+*/
+
+#include <string.h>
+#include <string>
+#include <deque>
+#include "libikbd.h"
+#include "ikbd_rtl.h"
+#include "ikbd_sim.h"
+#include "uart.h"
+#include "ps2.h"
+
+struct ikbd {
+  ikbd(ikbd_model *m) : tb(m), time(0), reset_cycles(5), due(0),
+    st(UINT64_MAX), tx_tpb(0), rxcnt(0), rxsr(0), rx_next(0), rx_tpb(0), out_head(0), out_tail(0), out_lost(0) {
+    tb->res = 1;
+  }
+  ~ikbd() { delete tb; }
+
+  ikbd_model *tb;
+  uint64_t time;        // in ns
+  int reset_cycles;     // cycles left in reset
+
+  // the transactors are only looked at when one of them is due
+  uint64_t due;
+
+  // serial to the ikbd
+  uart_tx uart;
+  uint64_t st, tx_tpb;
+
+  // serial from the ikbd
+  int rxcnt, rxsr;
+  uint64_t rx_start, rx_next, rx_tpb;
+
+  ps2_device ps2[2];
+
+  struct joy_change {
+    uint64_t time;
+    int port;
+    uint8_t state;
+  };
+  std::deque<joy_change> joy;
+
+  ikbd_output_t out[IKBD_OUTPUT_SIZE];
+  uint64_t out_head, out_tail, out_lost;
+
+  void tick(int c);
+  void service();
+  void output(uint8_t b);
+  void schedule();
+};
+
+// the earliest time any transactor needs to run at
+void ikbd::schedule() {
+  due = st;
+  for(int i=0;i<2;i++)
+    if(ps2[i].due < due) due = ps2[i].due;
+  if(rxcnt && rx_next < due) due = rx_next;
+  if(!joy.empty() && joy.front().time < due) due = joy.front().time;
+}
+
+void ikbd::output(uint8_t b) {
+  if(out_head - out_tail == IKBD_OUTPUT_SIZE) {
+    out_lost++;
+    return;
+  }
+  ikbd_output_t &o = out[out_head++ % IKBD_OUTPUT_SIZE];
+  o.time = rx_start;
+  o.value = b;
+}
+
+void ikbd::service() {
+  // sample the ikbd's tx in the middle of each bit
+  if(rxcnt && time >= rx_next) {
+    int bit = tb->tx;
+    if(--rxcnt) {
+      if(rxcnt < 9) rxsr = (rxsr >> 1) | (bit?0x80:0);
+      rx_next += rx_tpb;
+    } else if(bit)
+      output(rxsr);
+  }
+
+  // drive the ikbd's rx, the bit time follows its rate setting
+  if(time >= st) {
+    if(uart.start_bit()) tx_tpb = sci_tpb(tb->dbg_rmcr);
+    size_t done;
+    tb->rx = uart.next(&done);
+    st = uart.busy()?time + tx_tpb:UINT64_MAX;
+  }
+
+  for(int i=0;i<2;i++) {
+    ps2_device &d = ps2[i];
+    if(time < d.due) continue;
+    d.run(time);
+    uint8_t clk = d.clk && !d.inhibited;
+    if(i) { tb->ps2_mouse_clk = clk; tb->ps2_mouse_data = d.data; }
+    else  { tb->ps2_kbd_clk = clk;   tb->ps2_kbd_data = d.data; }
+  }
+
+  while(!joy.empty() && joy.front().time <= time) {
+    if(joy.front().port) tb->joystick1 = joy.front().state;
+    else                 tb->joystick0 = joy.front().state;
+    joy.pop_front();
+  }
+
+  schedule();
+}
+
+void ikbd::tick(int c) {
+  tb->clk = c;
+  tb->eval();
+  time += 250;
+
+  // a start bit on the ikbd's tx
+  if(!rxcnt && !tb->tx) {
+    rxcnt = 10;
+    rxsr = 0;
+    rx_start = time;
+    rx_tpb = sci_tpb(tb->dbg_rmcr);
+    rx_next = time + rx_tpb/2;
+    if(rx_next < due) due = rx_next;
+  }
+
+  if(time >= due) service();
+}
+
+extern "C" {
+
+ikbd_t *ikbd_open(const char *model, const char *rom_dir) {
+  ikbd_model *m;
+  if(!strcmp(model, "rtl"))
+    m = new ikbd_rtl;
+  else if(!strcmp(model, "sim")) {
+    std::string dir(rom_dir?rom_dir:"../rom");
+    m = new ikbd_sim((dir + "/ikbd.hex").c_str(), (dir + "/keymap.hex").c_str());
+  } else
+    return NULL;
+
+  return new ikbd(m);
+}
+
+void ikbd_close(ikbd_t *k) {
+  delete k;
+}
+
+// same format as written by the testbench, see snapshot_save()
+int ikbd_restore(ikbd_t *k, const char *snapshot) {
+  if(!k->tb->savable()) return -1;
+
+  VerilatedRestore os;
+  os.open(snapshot);
+  if(!os.isOpen()) return -1;
+
+  std::string model;
+  uint64_t time;
+  os >> model >> time;
+  if(model != k->tb->name()) {
+    os.close();
+    return -1;
+  }
+  k->tb->restore(os);
+  os.close();
+
+  // the transactors start over idle
+  k->time = time;
+  k->reset_cycles = 0;
+  k->uart = uart_tx();
+  k->st = UINT64_MAX;
+  k->rxcnt = 0;
+  for(int i=0;i<2;i++)
+    k->ps2[i] = ps2_device();
+  k->joy.clear();
+  k->out_head = k->out_tail = k->out_lost = 0;
+  k->schedule();
+  return 0;
+}
+
+uint64_t ikbd_step(ikbd_t *k, uint64_t cycles) {
+  for(uint64_t i=0;i<cycles;i++) {
+    k->tick(1);
+    k->tick(0);
+    if(k->reset_cycles && !--k->reset_cycles)
+      k->tb->res = 0;
+  }
+  return k->time;
+}
+
+uint64_t ikbd_time(const ikbd_t *k) {
+  return k->time;
+}
+
+void ikbd_ps2_send(ikbd_t *k, int dev, const uint8_t *data, size_t len) {
+  if(!len) return;
+
+  std::vector<io_step> msg;
+  for(size_t i=0;i<len;i++)
+    msg.push_back( { IO_BYTE, data[i] } );
+  k->ps2[dev?1:0].send(msg, k->time);
+  k->schedule();
+}
+
+void ikbd_serial_send(ikbd_t *k, const uint8_t *data, size_t len) {
+  if(!len) return;
+
+  bool idle = !k->uart.busy();
+  k->uart.send(data, len);
+  if(idle) k->st = k->time;
+  k->schedule();
+}
+
+size_t ikbd_serial_queued(const ikbd_t *k) {
+  return k->uart.queued();
+}
+
+size_t ikbd_ps2_queued(const ikbd_t *k, int dev) {
+  return k->ps2[dev?1:0].queued();
+}
+
+void ikbd_joystick(ikbd_t *k, int port, uint8_t state, uint64_t time) {
+  // kept in order of their time
+  ikbd::joy_change c = { time < k->time?k->time:time, port?1:0, state };
+  std::deque<ikbd::joy_change>::iterator i = k->joy.end();
+  while(i != k->joy.begin() && (i-1)->time > c.time) i--;
+  k->joy.insert(i, c);
+  k->schedule();
+}
+
+size_t ikbd_output_peek(ikbd_t *k, const ikbd_output_t **out) {
+  size_t pos = k->out_tail % IKBD_OUTPUT_SIZE;
+  size_t n = k->out_head - k->out_tail;
+  if(pos + n > IKBD_OUTPUT_SIZE) n = IKBD_OUTPUT_SIZE - pos;
+  *out = k->out + pos;
+  return n;
+}
+
+void ikbd_output_consume(ikbd_t *k, size_t n) {
+  if(n > k->out_head - k->out_tail) n = k->out_head - k->out_tail;
+  k->out_tail += n;
+}
+
+uint64_t ikbd_output_lost(const ikbd_t *k) {
+  return k->out_lost;
+}
+
+int ikbd_caps_lock(const ikbd_t *k) {
+  return k->tb->caps_lock;
+}
+
+}
@@ -0,0 +1,96 @@
+/*
+  libikbd.h
+
+  C interface of the ikbd models for embedding them into emulators
+  or scripting languages. A handle holds one model with its own ps2
+  keyboard and mouse, joystick and serial transactors, so the host
+  only queues input and collects the bytes the ikbd sends instead of
+  driving its pins every half cycle.
+
+  Time advances in ikbd_step() only, in cycles of the 2MHz clock
+  (500ns). Inputs queued between two steps start at the time the
+  model has reached. Output bytes are decoded from the ikbd's tx line
+  and kept in a ring buffer which the host reads in place.
+
+  Handles are independent of each other and may be used from
+  different threads, a single handle must not.
+*/
+
+#ifndef LIBIKBD_H
+#define LIBIKBD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ikbd ikbd_t;
+
+// a byte sent by the ikbd
+typedef struct {
+  uint64_t time;       // of its start bit in ns
+  uint8_t value;
+} ikbd_output_t;
+
+// output bytes buffered, older ones are kept if the host doesn't
+// read them in time
+#define IKBD_OUTPUT_SIZE  4096
+
+// ps2 devices
+#define IKBD_PS2_KBD    0
+#define IKBD_PS2_MOUSE  1
+
+// model is "rtl" for the verilated ikbd.sv or "sim" for the faster
+// C++ model. rom_dir is the directory with ikbd.hex and keymap.hex
+// which the sim model loads at runtime, NULL is ../rom. The ikbd is
+// held in reset for the first five cycles of ikbd_step(). Returns
+// NULL if the model is unknown
+ikbd_t *ikbd_open(const char *model, const char *rom_dir);
+void ikbd_close(ikbd_t *k);
+
+// restore the state saved by the testbench's -S option, e.g. to skip
+// the 66ms the rom takes to boot. It has to be from the same model.
+// Queued input and output are dropped. Returns 0 on success
+int ikbd_restore(ikbd_t *k, const char *snapshot);
+
+// run the ikbd for this many cycles, returns the time in ns
+uint64_t ikbd_step(ikbd_t *k, uint64_t cycles);
+uint64_t ikbd_time(const ikbd_t *k);
+
+// queue bytes for a ps2 device, they are sent back to back at the
+// device's clock. Mouse packets are the four byte packets of a
+// wheel mouse
+void ikbd_ps2_send(ikbd_t *k, int dev, const uint8_t *data, size_t len);
+
+// queue bytes to be sent to the ikbd's rx line at the rate its sci
+// is set to
+void ikbd_serial_send(ikbd_t *k, const uint8_t *data, size_t len);
+
+// bytes not yet sent to the ikbd or by a ps2 device
+size_t ikbd_serial_queued(const ikbd_t *k);
+size_t ikbd_ps2_queued(const ikbd_t *k, int dev);
+
+// a joystick port changes at time ns, or right away if that has
+// passed. Bit 0-3 are up, down, left and right, bit 4 is fire
+void ikbd_joystick(ikbd_t *k, int port, uint8_t state, uint64_t time);
+
+// the oldest output bytes not consumed yet. *out points into the ring
+// buffer and stays valid until the next ikbd_step() or consume. The
+// count returned may be less than all bytes buffered when they wrap
+// around the end of the buffer
+size_t ikbd_output_peek(ikbd_t *k, const ikbd_output_t **out);
+void ikbd_output_consume(ikbd_t *k, size_t n);
+
+// output bytes dropped because the buffer was full
+uint64_t ikbd_output_lost(const ikbd_t *k);
+
+// state of the caps lock led
+int ikbd_caps_lock(const ikbd_t *k);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBIKBD_H
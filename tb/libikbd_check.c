@@ -0,0 +1,118 @@
+/*
+  libikbd_check.c
+
+  Small C host of libikbd.so as an emulator would use it. It boots
+  the ikbd from reset, types a key on the ps2 keyboard, asks for the
+  mouse button action with $87 and checks the bytes and timestamps
+  in the output ring:
+
+    ./libikbd_check rtl
+    ./libikbd_check sim ../rom
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libikbd.h"
+
+// 1ms of 2MHz cycles
+#define STEP_CYCLES  2000
+
+// start bit to start bit of 10 bits at 7812.5 bit/s
+#define BYTE_NS  1280000ull
+
+static uint64_t last_time;
+
+// run the ikbd for up to ms until it has sent n bytes and compare
+// them to expect, n 0 runs the whole time. A byte is decoded at its
+// stop bit, so it must start less than a byte time before the step
+// it shows up in, and no sooner than a byte time after the last one
+static int expect_bytes(ikbd_t *k, const char *what, const uint8_t *expect,
+			size_t n, int ms) {
+  size_t got = 0;
+  int ok = 1;
+
+  while(ms-- > 0 && (!n || got < n)) {
+    uint64_t start = ikbd_time(k);
+    uint64_t end = ikbd_step(k, STEP_CYCLES);
+
+    const ikbd_output_t *o;
+    size_t cnt;
+    while((cnt = ikbd_output_peek(k, &o))) {
+      for(size_t i=0;i<cnt;i++) {
+	if(got == n) {
+	  printf("%s: unexpected byte %02x\n", what, o[i].value);
+	  ok = 0;
+	  continue;
+	}
+	if(o[i].value != expect[got]) {
+	  printf("%s: byte %zu is %02x instead of %02x\n", what, got, o[i].value, expect[got]);
+	  ok = 0;
+	}
+	if(o[i].time + BYTE_NS < start || o[i].time > end) {
+	  printf("%s: byte %zu at %.2fus outside of the step from %.2fus to %.2fus\n",
+		 what, got, o[i].time/1000.0, start/1000.0, end/1000.0);
+	  ok = 0;
+	}
+	if(last_time && o[i].time < last_time + BYTE_NS) {
+	  printf("%s: byte %zu at %.2fus only %.2fus after the one before\n",
+		 what, got, o[i].time/1000.0, (o[i].time - last_time)/1000.0);
+	  ok = 0;
+	}
+	last_time = o[i].time;
+	got++;
+      }
+      ikbd_output_consume(k, cnt);
+    }
+  }
+
+  if(got < n) {
+    printf("%s: %zu of %zu bytes received\n", what, got, n);
+    ok = 0;
+  }
+  printf("%-24s %s @%.2fus\n", what, ok?"ok":"FAILED", last_time/1000.0);
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  if(argc < 2 || argc > 3) {
+    printf("Usage: %s rtl|sim [rom_dir]\n", argv[0]);
+    return 1;
+  }
+
+  ikbd_t *k = ikbd_open(argv[1], argc > 2?argv[2]:NULL);
+  if(!k) {
+    printf("Unknown model %s\n", argv[1]);
+    return 1;
+  }
+
+  // the rom's self test takes 66ms
+  static const uint8_t boot[] = { 0xf1 };
+  // A on the ps2 keyboard is $1e on the ST
+  static const uint8_t a_make[] = { 0x1c }, a_press[] = { 0x1e };
+  static const uint8_t a_break[] = { 0xf0, 0x1c }, a_release[] = { 0x9e };
+  // status reply of the default mouse button action
+  static const uint8_t query[] = { 0x87 };
+  static const uint8_t status[] = { 0xf6, 0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+  int ok = expect_bytes(k, "boot", boot, sizeof(boot), 100);
+
+  ikbd_ps2_send(k, IKBD_PS2_KBD, a_make, sizeof(a_make));
+  ok = expect_bytes(k, "key press", a_press, sizeof(a_press), 100) && ok;
+  ikbd_ps2_send(k, IKBD_PS2_KBD, a_break, sizeof(a_break));
+  ok = expect_bytes(k, "key release", a_release, sizeof(a_release), 100) && ok;
+
+  ikbd_serial_send(k, query, sizeof(query));
+  ok = expect_bytes(k, "mouse button action", status, sizeof(status), 100) && ok;
+
+  // nothing else must follow
+  ok = expect_bytes(k, "idle", NULL, 0, 20) && ok;
+
+  if(ikbd_output_lost(k)) {
+    printf("%llu output bytes lost\n", (unsigned long long)ikbd_output_lost(k));
+    ok = 0;
+  }
+
+  ikbd_close(k);
+  return ok?0:1;
+}
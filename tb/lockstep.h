@@ -0,0 +1,292 @@
+/*
+  lockstep.h
+
+  Runs two ikbd models side by side on the same input pins and
+  reports the first instruction at which their cpu state or port
+  outputs differ. The edges of the sci's tx output and the steps of
+  the ps2 mouse are compared separately. This is used to verify the fast C++ model against the
+  verilated RTL.
+*/
+
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stdio.h>
+#include <deque>
+#include "ikbd_model.h"
+
+class ikbd_lockstep : public ikbd_model {
+public:
+  // now is the testbench's time in ns, the clock edges aren't 250ns
+  // apart with a faster cpu
+  ikbd_lockstep(ikbd_model *ref, ikbd_model *dut, const uint64_t *now, FILE *log = stdout) :
+    ref(ref), dut(dut), diverged(false), now(now), log(log) { }
+
+  ~ikbd_lockstep() { delete ref; delete dut; }
+
+  void eval() {
+    ikbd_model *m[2] = { ref, dut };
+
+    for(int i=0;i<2;i++) {
+      m[i]->clk = clk;
+      m[i]->res = res;
+      m[i]->periph_en = periph_en;
+      m[i]->ps2_kbd_clk = ps2_kbd_clk;
+      m[i]->ps2_kbd_data = ps2_kbd_data;
+      m[i]->ps2_mouse_clk = ps2_mouse_clk;
+      m[i]->ps2_mouse_data = ps2_mouse_data;
+      m[i]->rx = rx;
+      m[i]->joystick0 = joystick0;
+      m[i]->joystick1 = joystick1;
+      m[i]->sci_tx_slots = sci_tx_slots;
+      m[i]->eval();
+
+      // record the state at every new instruction
+      if(!res && m[i]->dbg_icnt != last_icnt[i]) {
+	last_icnt[i] = m[i]->dbg_icnt;
+	if(!diverged) q[i].push_back(state(m[i]));
+      }
+
+      if(m[i]->tx != last_tx[i]) {
+	last_tx[i] = m[i]->tx;
+	if(!res && !diverged) tx_edges[i].push_back(*now);
+      }
+
+      if(m[i]->dbg_mouse != last_mouse[i]) {
+	last_mouse[i] = m[i]->dbg_mouse;
+	if(!res && !diverged) mouse_steps[i].push_back(step(*now, last_mouse[i]));
+      }
+    }
+
+    // the reference model drives the outputs
+    tx = ref->tx;
+    caps_lock = ref->caps_lock;
+    joy_port_toggle = ref->joy_port_toggle;
+    dbg_pc = ref->dbg_pc;
+    dbg_a = ref->dbg_a;
+    dbg_b = ref->dbg_b;
+    dbg_cc = ref->dbg_cc;
+    dbg_x = ref->dbg_x;
+    dbg_sp = ref->dbg_sp;
+    dbg_icnt = ref->dbg_icnt;
+    dbg_opcode = ref->dbg_opcode;
+    dbg_trcsr = ref->dbg_trcsr;
+    dbg_rmcr = ref->dbg_rmcr;
+    dbg_po2 = ref->dbg_po2;
+    dbg_po3 = ref->dbg_po3;
+    dbg_po4 = ref->dbg_po4;
+    dbg_mouse = ref->dbg_mouse;
+
+    if(res) {
+      q[0].clear(); q[1].clear();
+      tx_edges[0].clear(); tx_edges[1].clear();
+      mouse_steps[0].clear(); mouse_steps[1].clear();
+      count = tx_count = mouse_count = 0;
+      return;
+    }
+
+    compare();
+    compare_tx();
+    compare_mouse();
+  }
+
+  const char *name() const { return "lockstep"; }
+  bool failed() const { return diverged; }
+  bool savable() const { return ref->savable() && dut->savable(); }
+
+  void save(VerilatedSerialize &os) {
+    ikbd_model::save(os);
+    ref->save(os);
+    dut->save(os);
+
+    // instructions one model has already run but the other not yet
+    for(int i=0;i<2;i++) {
+      uint32_t n = q[i].size();
+      os << last_icnt[i] << n;
+      for(auto &s : q[i]) os.write(&s, sizeof(s));
+    }
+    for(int i=0;i<2;i++) {
+      uint32_t n = tx_edges[i].size();
+      os << last_tx[i] << n;
+      for(auto t : tx_edges[i]) os << t;
+    }
+    for(int i=0;i<2;i++) {
+      uint32_t n = mouse_steps[i].size();
+      os << last_mouse[i] << n;
+      for(auto &s : mouse_steps[i]) os << s.time << s.lines;
+    }
+    os << count << tx_count << mouse_count << diverged;
+  }
+
+  void restore(VerilatedDeserialize &os) {
+    ikbd_model::restore(os);
+    ref->restore(os);
+    dut->restore(os);
+
+    for(int i=0;i<2;i++) {
+      uint32_t n;
+      os >> last_icnt[i] >> n;
+      q[i].clear();
+      while(n--) {
+	state s;
+	os.read(&s, sizeof(s));
+	q[i].push_back(s);
+      }
+    }
+    for(int i=0;i<2;i++) {
+      uint32_t n;
+      os >> last_tx[i] >> n;
+      tx_edges[i].clear();
+      while(n--) {
+	uint64_t t;
+	os >> t;
+	tx_edges[i].push_back(t);
+      }
+    }
+    for(int i=0;i<2;i++) {
+      uint32_t n;
+      os >> last_mouse[i] >> n;
+      mouse_steps[i].clear();
+      while(n--) {
+	step s;
+	os >> s.time >> s.lines;
+	mouse_steps[i].push_back(s);
+      }
+    }
+    os >> count >> tx_count >> mouse_count >> diverged;
+  }
+
+  ikbd_model *ref, *dut;
+  bool diverged;
+
+private:
+  struct state {
+    state() { }
+    state(const ikbd_model *m) :
+      pc(m->dbg_pc), op(m->dbg_opcode), a(m->dbg_a), b(m->dbg_b), cc(m->dbg_cc & 0x3f),
+      x(m->dbg_x), sp(m->dbg_sp),
+      // the sci shifts out bits independently of the instruction
+      // stream, so P24 is not compared here
+      po2(m->dbg_po2 & ~0x10), po3(m->dbg_po3), po4(m->dbg_po4) { }
+
+    bool operator!=(const state &s) const {
+      return pc != s.pc || op != s.op || a != s.a || b != s.b || cc != s.cc ||
+	x != s.x || sp != s.sp || po2 != s.po2 || po3 != s.po3 || po4 != s.po4;
+    }
+
+    void print(FILE *log, const char *name) const {
+      fprintf(log, "  %-4s PC=%04x OP=%02x A=%02x B=%02x X=%04x SP=%04x CC=%02x P2=%02x P3=%02x P4=%02x\n",
+	     name, pc, op, a, b, x, sp, cc, po2, po3, po4);
+    }
+
+    uint16_t pc;
+    uint8_t op;
+    uint8_t a, b, cc;
+    uint16_t x, sp;
+    uint8_t po2, po3, po4;
+  };
+
+  void compare() {
+    while(!diverged && !q[0].empty() && !q[1].empty()) {
+      if(q[0].front() != q[1].front()) {
+	fprintf(log, "@%.2fµs LOCKSTEP diverged at instruction %llu\n",
+	       *now/1000.0, (unsigned long long)count);
+	q[0].front().print(log, ref->name());
+	q[1].front().print(log, dut->name());
+	diverged = true;
+	return;
+      }
+      q[0].pop_front();
+      q[1].pop_front();
+      count++;
+    }
+
+    // one model running far ahead means the timing drifted apart
+    if(!diverged && (q[0].size() > MAX_SKEW || q[1].size() > MAX_SKEW)) {
+      fprintf(log, "@%.2fµs LOCKSTEP instruction streams drifted apart after instruction %llu\n",
+	     *now/1000.0, (unsigned long long)count);
+      diverged = true;
+    }
+  }
+
+  // The C++ model holds its TDR writes back to the cycle the verilog
+  // core does them, so both start a byte on the same bit boundary.
+  // Edges more than TX_SLACK_NS apart or only sent by one model are
+  // a divergence
+  void compare_tx() {
+    while(!diverged && !tx_edges[0].empty() && !tx_edges[1].empty()) {
+      uint64_t a = tx_edges[0].front(), b = tx_edges[1].front();
+      if((a > b)?a - b > TX_SLACK_NS:b - a > TX_SLACK_NS) {
+	fprintf(log, "@%.2fµs LOCKSTEP sci tx edge %llu at %.2fµs (%s) and %.2fµs (%s)\n",
+		*now/1000.0, (unsigned long long)tx_count,
+		a/1000.0, ref->name(), b/1000.0, dut->name());
+	diverged = true;
+	return;
+      }
+      tx_edges[0].pop_front();
+      tx_edges[1].pop_front();
+      tx_count++;
+    }
+
+    for(int i=0;i<2 && !diverged;i++)
+      if(!tx_edges[i].empty() && tx_edges[i].front() + TX_SLACK_NS < *now) {
+	fprintf(log, "@%.2fµs LOCKSTEP sci tx edge %llu at %.2fµs only sent by %s\n",
+		*now/1000.0, (unsigned long long)tx_count,
+		tx_edges[i].front()/1000.0, i?dut->name():ref->name());
+	diverged = true;
+      }
+  }
+
+  // The mouse lines are an input of the cpu, a step the rom misses
+  // wouldn't show up in the cpu state. Both models must change them
+  // to the same value within TX_SLACK_NS
+  void compare_mouse() {
+    while(!diverged && !mouse_steps[0].empty() && !mouse_steps[1].empty()) {
+      const step &a = mouse_steps[0].front(), &b = mouse_steps[1].front();
+      if(a.lines != b.lines ||
+	 ((a.time > b.time)?a.time - b.time > TX_SLACK_NS:b.time - a.time > TX_SLACK_NS)) {
+	fprintf(log, "@%.2fµs LOCKSTEP mouse step %llu to %02x at %.2fµs (%s) and %02x at %.2fµs (%s)\n",
+		*now/1000.0, (unsigned long long)mouse_count,
+		a.lines, a.time/1000.0, ref->name(), b.lines, b.time/1000.0, dut->name());
+	diverged = true;
+	return;
+      }
+      mouse_steps[0].pop_front();
+      mouse_steps[1].pop_front();
+      mouse_count++;
+    }
+
+    for(int i=0;i<2 && !diverged;i++)
+      if(!mouse_steps[i].empty() && mouse_steps[i].front().time + TX_SLACK_NS < *now) {
+	fprintf(log, "@%.2fµs LOCKSTEP mouse step %llu to %02x at %.2fµs only made by %s\n",
+		*now/1000.0, (unsigned long long)mouse_count, mouse_steps[i].front().lines,
+		mouse_steps[i].front().time/1000.0, i?dut->name():ref->name());
+	diverged = true;
+      }
+  }
+
+  static const size_t MAX_SKEW = 1000;
+  // two cycles of the 2MHz clock
+  static const uint64_t TX_SLACK_NS = 1000;
+
+  const uint64_t *now;
+  FILE *log;
+  std::deque<state> q[2];
+  uint32_t last_icnt[2] = { 0, 0 };
+  uint64_t count = 0;
+  std::deque<uint64_t> tx_edges[2];   // times of the tx edges not compared yet
+  uint8_t last_tx[2] = { 1, 1 };
+  uint64_t tx_count = 0;
+
+  struct step {
+    step() { }
+    step(uint64_t time, uint8_t lines) : time(time), lines(lines) { }
+    uint64_t time;
+    uint8_t lines;
+  };
+  std::deque<step> mouse_steps[2];    // changes of dbg_mouse not compared yet
+  uint8_t last_mouse[2] = { 0, 0 };
+  uint64_t mouse_count = 0;
+};
+
+#endif // LOCKSTEP_H
@@ -0,0 +1,164 @@
+/*
+  ps2.h
+
+  PS/2 device transactor, one instance each for the keyboard and the
+  mouse. Messages are queued and their bytes sent as a start bit, 8
+  data bits lsb first, odd parity and a stop bit. The device sets up
+  data while the clock is high and the host samples it on the falling
+  edge. After the rising edge following the stop bit the lines stay
+  idle for idle_ns or for the length of a pause in the message
+  before the next start bit.
+
+  The host may inhibit the device by holding the clock low. A byte
+  interrupted before the falling edge of its stop bit is aborted and
+  sent again from its start bit once the host releases the clock.
+  A byte doesn't start while the clock is inhibited.
+
+  The testbench calls run() whenever due is reached and drives clk
+  and data onto the ikbd's pins, with the clock forced low while
+  inhibited.
+*/
+
+#ifndef PS2_H
+#define PS2_H
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include "scenario.h"
+
+#define PS2_KHZ         12.0      // default clock, 10 to 16.7 kHz
+#define PS2_RELEASE_NS  50000ull  // device waits after the host released the clock
+
+// events of run()
+#define PS2_NONE   0
+#define PS2_START  1   // start bit of byte()
+#define PS2_SENT   2   // host sampled the stop bit of byte()
+#define PS2_ABORT  3   // byte() interrupted by the host
+
+class ps2_device {
+public:
+  ps2_device() : half_ns(half(PS2_KHZ)), idle_ns(0), clk(1), data(1),
+    inhibited(false), due(UINT64_MAX), state(IDLE), bit(0) { }
+
+  static uint64_t half(double khz) { return 1000000.0 / khz / 2; }
+
+  uint64_t half_ns;    // half of the clock period
+  uint64_t idle_ns;    // idle time between bytes
+  uint8_t clk, data;   // levels driven by the device
+  bool inhibited;      // clock held low by the host
+  uint64_t due;        // time run() needs to be called at
+
+  bool busy() const { return state != IDLE; }
+
+  // bytes waiting incl. the one being sent
+  size_t queued() const { return fifo.size(); }
+
+  // the byte being sent and whether it ends its message
+  uint8_t byte() const { return fifo.front().value; }
+  bool last() const { return fifo.front().last; }
+
+  // queue a message. If the device was idle it starts right away
+  void send(const std::vector<io_step> &msg, uint64_t now) {
+    size_t last = msg.size() - 1;
+    if(msg[last].op == IO_PAUSE) last--;
+    for(size_t i=0;i<msg.size();i++)
+      fifo.push_back( { msg[i].op, msg[i].value, i == last } );
+
+    if(state == IDLE) {
+      state = WAIT;
+      due = now;
+    }
+  }
+
+  int run(uint64_t now) {
+    if(now < due) return PS2_NONE;
+    due = UINT64_MAX;
+
+    if(state == WAIT) {
+      // a pause ahead of the byte has passed
+      if(!fifo.empty() && fifo.front().op == IO_PAUSE)
+	fifo.pop_front();
+      if(fifo.empty()) {
+	state = IDLE;
+	return PS2_NONE;
+      }
+
+      // resumed by release()
+      if(inhibited) return PS2_NONE;
+
+      state = BYTE;
+      bit = 0;
+      data = 0;
+      due = now + half_ns;
+      return PS2_START;
+    }
+
+    if(state != BYTE) return PS2_NONE;
+
+    // the host samples data on the falling edge
+    due = now + half_ns;
+    if(clk) {
+      clk = 0;
+      return (bit == 10)?PS2_SENT:PS2_NONE;
+    }
+
+    clk = 1;
+    if(bit < 10) {
+      bit++;
+      data = level();
+      return PS2_NONE;
+    }
+
+    // byte done, wait for the next one
+    fifo.pop_front();
+    state = WAIT;
+    due = now + ((!fifo.empty() && fifo.front().op == IO_PAUSE)?
+		 1000000ull * fifo.front().value:idle_ns);
+    return due == now?run(now):PS2_NONE;
+  }
+
+  // the host pulls the clock low. Returns PS2_ABORT if this
+  // interrupted a byte
+  int inhibit() {
+    inhibited = true;
+    if(state != BYTE || (bit == 10 && !clk))
+      return PS2_NONE;
+
+    clk = data = 1;
+    state = WAIT;
+    due = UINT64_MAX;
+    return PS2_ABORT;
+  }
+
+  // the host releases the clock, a waiting byte is started
+  void release(uint64_t now) {
+    inhibited = false;
+    if(state == WAIT && due == UINT64_MAX)
+      due = now + PS2_RELEASE_NS;
+  }
+
+private:
+  struct entry {
+    uint8_t op;      // IO_BYTE or IO_PAUSE
+    int value;
+    bool last;       // last byte of its message
+  };
+  std::deque<entry> fifo;
+
+  enum { IDLE, WAIT, BYTE } state;
+  int bit;           // 0 start, 1-8 data, 9 parity, 10 stop
+
+  int level() const {
+    int b = fifo.front().value;
+    if(bit <= 8) return (b >> (bit-1)) & 1;
+    if(bit == 10) return 1;
+
+    int par = 1;
+    for(int i=0;i<8;i++)
+      if(b & (1<<i)) par = !par;
+    return par;
+  }
+};
+
+#endif // PS2_H
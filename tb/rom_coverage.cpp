@@ -0,0 +1,89 @@
+/*
+  rom_coverage.cpp
+
+  Instruction and branch coverage of the ikbd rom, see rom_coverage.h
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "rom_coverage.h"
+
+// an interrupt or swi pushes all 7 bytes of registers
+#define INTR_PUSH  7
+
+rom_coverage::rom_coverage() : last_icnt(0), last_slot(-1), last_pc(0), last_sp(0) {
+  memset(hits, 0, sizeof(hits));
+  memset(taken, 0, sizeof(taken));
+  memset(not_taken, 0, sizeof(not_taken));
+  memset(branch, 0, sizeof(branch));
+}
+
+void rom_coverage::instruction(uint16_t pc, uint16_t sp, uint8_t op) {
+  // a branch not taken continues right behind its two bytes
+  if(last_slot >= 0 && (int)last_sp - (int)sp < INTR_PUSH) {
+    if(pc == (uint16_t)(last_pc + 2)) not_taken[last_slot]++;
+    else                              taken[last_slot]++;
+  }
+
+  int s = slot(pc);
+  last_slot = -1;
+  if(s >= 0) {
+    hits[s]++;
+    if(COV_IS_BRANCH(op)) {
+      branch[s] = true;
+      last_slot = s;
+    }
+  }
+
+  last_pc = pc;
+  last_sp = sp;
+}
+
+bool rom_coverage::write(const char *file) const {
+  FILE *f = fopen(file, "w");
+  if(!f) return false;
+
+  fprintf(f, "# rom coverage of %s\n", name.c_str());
+  for(int s=0;s<COV_SLOTS;s++) {
+    if(!hits[s]) continue;
+    fprintf(f, "%04x %llu", address(s), (unsigned long long)hits[s]);
+    if(branch[s])
+      fprintf(f, " %llu %llu", (unsigned long long)taken[s], (unsigned long long)not_taken[s]);
+    fprintf(f, "\n");
+  }
+  return !fclose(f);
+}
+
+bool rom_coverage::read(const char *file) {
+  FILE *f = fopen(file, "r");
+  if(!f) return false;
+
+  char line[256];
+  bool ok = true;
+  while(ok && fgets(line, sizeof(line), f)) {
+    char n[200];
+    if(sscanf(line, "# rom coverage of %199s", n) == 1) {
+      if(name.empty()) name = n;
+      continue;
+    }
+
+    unsigned addr;
+    unsigned long long h, t, nt;
+    int fields = sscanf(line, "%x %llu %llu %llu", &addr, &h, &t, &nt);
+    int s = slot(addr);
+    if((fields != 2 && fields != 4) || s < 0) {
+      ok = false;
+      break;
+    }
+
+    hits[s] += h;
+    if(fields == 4) {
+      branch[s] = true;
+      taken[s] += t;
+      not_taken[s] += nt;
+    }
+  }
+
+  fclose(f);
+  return ok;
+}
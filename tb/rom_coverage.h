@@ -0,0 +1,75 @@
+/*
+  rom_coverage.h
+
+  Instruction coverage of the ikbd's rom at $f000-$ffff and of code
+  downloaded into the internal ram at $80-$ff. Every address an
+  instruction was fetched from is counted and for the conditional
+  branches also how often they were taken and not taken, which is
+  told by the address of the next instruction. A branch followed by
+  an interrupt isn't counted either way.
+
+  Like the rom profiler this samples the debug ports once per E
+  cycle, so with a faster cpu clock (-C) instructions get lost.
+
+  The coverage of a scenario is written as text, one line per
+  address executed with its count and for branches the times taken
+  and not taken:
+
+    # rom coverage of reset
+    f000 1
+    f004 1 0 1
+*/
+
+#ifndef ROM_COVERAGE_H
+#define ROM_COVERAGE_H
+
+#include <stdint.h>
+#include <string>
+#include "ikbd_model.h"
+
+// the rom first, then the ram
+#define COV_ROM    0xf000
+#define COV_RAM    0x0080
+#define COV_SLOTS  (4096 + 128)
+
+// bcc, bcs, beq, ... but neither bra nor brn
+#define COV_IS_BRANCH(op)  ((op) >= 0x22 && (op) <= 0x2f)
+
+class rom_coverage {
+public:
+  rom_coverage();
+
+  // called once per E cycle
+  void sample(const ikbd_model *m) {
+    if(m->dbg_icnt != last_icnt) {
+      last_icnt = m->dbg_icnt;
+      instruction(m->dbg_pc, m->dbg_sp, m->dbg_opcode);
+    }
+  }
+
+  bool write(const char *file) const;
+
+  // add the coverage in file to this one
+  bool read(const char *file);
+
+  static int slot(uint16_t addr) {
+    if(addr >= COV_ROM) return addr - COV_ROM;
+    if(addr >= COV_RAM && addr < 0x100) return 4096 + addr - COV_RAM;
+    return -1;
+  }
+  static uint16_t address(int slot) {
+    return slot < 4096?COV_ROM + slot:COV_RAM + slot - 4096;
+  }
+
+  std::string name;
+  uint64_t hits[COV_SLOTS], taken[COV_SLOTS], not_taken[COV_SLOTS];
+  bool branch[COV_SLOTS];
+
+private:
+  uint32_t last_icnt;
+  int last_slot;          // a branch waiting for its outcome or -1
+  uint16_t last_pc, last_sp;
+  void instruction(uint16_t pc, uint16_t sp, uint8_t op);
+};
+
+#endif // ROM_COVERAGE_H
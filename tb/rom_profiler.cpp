@@ -0,0 +1,191 @@
+/*
+  rom_profiler.cpp
+
+  Cycle profile of the ikbd rom, see rom_profiler.h
+*/
+
+#include <string.h>
+#include <algorithm>
+#include <set>
+#include "rom_profiler.h"
+
+#define ROM_START  0xf000
+
+// jsr direct, indexed and extended and bsr
+#define IS_CALL(op)  ((op) == 0x9d || (op) == 0xad || (op) == 0xbd || (op) == 0x8d)
+
+// an interrupt or swi pushes all 7 bytes of registers
+#define INTR_PUSH  7
+
+rom_profiler::rom_profiler() :
+  stack_id(0), cur(NULL), cur_sym(0), last_icnt(0), last_sp(0), last_op(0) {
+  // everything outside the rom is code downloaded into the ram
+  add_symbol(0, "ram");
+  add_symbol(ROM_START, "f000");
+
+  stacks.push_back(std::vector<int>());
+  stack_ids[stacks[0]] = 0;
+  cur_sym = sym[ROM_START];
+  cur = &cycles[std::make_pair(0, cur_sym)];
+}
+
+int rom_profiler::add_symbol(uint16_t start, const std::string &name) {
+  // a new symbol ends the previous one. Symbols come in order of
+  // their address
+  symbol s = { start, 0xffff, name, 0 };
+  if(!symbols.empty())
+    symbols.back().end = start - 1;
+  symbols.push_back(s);
+
+  int n = symbols.size() - 1;
+  for(int a=start;a<=0xffff;a++)
+    sym[a] = n;
+
+  return n;
+}
+
+// The disassembly has comment lines starting with ';' and a few plain
+// text labels between the code lines. The first non-empty line before
+// some code names it
+bool rom_profiler::load_symbols(const char *asm_file) {
+  FILE *f = fopen(asm_file, "r");
+  if(!f) {
+    printf("Unable to open %s\n", asm_file);
+    return false;
+  }
+
+  char line[256];
+  std::string label;
+  while(fgets(line, sizeof(line), f)) {
+    unsigned addr;
+    char c;
+
+    line[strcspn(line, "\r\n")] = 0;
+    if(!line[0] || line[0] == '*')
+      continue;
+
+    if(sscanf(line, "%4x%c", &addr, &c) == 2 && (c == '\t' || c == ' ')) {
+      if(!label.empty() && addr > symbols.back().start) {
+	char name[16];
+	sprintf(name, "%04x ", addr);
+	add_symbol(addr, name + label);
+      }
+      label.clear();
+      continue;
+    }
+
+    // remove the comment character and anything after another one,
+    // the result is used in collapsed stacks which are ';' separated
+    char *s = line + strspn(line, "; \t");
+    s[strcspn(s, ";")] = 0;
+
+    // collapse white space
+    std::string l;
+    for(char *p = strtok(s, " \t"); p; p = strtok(NULL, " \t"))
+      l += (l.empty()?"":" ") + std::string(p);
+
+    if(label.empty())
+      label = l;
+  }
+
+  fclose(f);
+
+  // the initial sample counter may refer to a symbol now split
+  cycles.clear();
+  cur_sym = sym[ROM_START];
+  cur = &cycles[std::make_pair(stack_id, cur_sym)];
+  return true;
+}
+
+void rom_profiler::instruction(uint16_t pc, uint16_t sp, uint8_t op) {
+  bool changed = false;
+
+  // returned from a subroutine or interrupt, the stack pointer is
+  // above the frame again. A reload of the stack pointer also lands
+  // here
+  while(!stack.empty() && sp > stack.back().sp) {
+    stack.pop_back();
+    changed = true;
+  }
+
+  // a subroutine call or an interrupt. The frame records where the
+  // call was made from
+  if(IS_CALL(last_op) || (int)last_sp - (int)sp >= INTR_PUSH) {
+    frame fr = { sp, cur_sym };
+    stack.push_back(fr);
+    symbols[sym[pc]].calls++;
+    changed = true;
+  }
+
+  if(changed)
+    stack_changed();
+
+  cur_sym = sym[pc];
+  cur = &cycles[std::make_pair(stack_id, cur_sym)];
+
+  last_sp = sp;
+  last_op = op;
+}
+
+void rom_profiler::stack_changed() {
+  std::vector<int> s;
+  for(size_t i=0;i<stack.size();i++)
+    s.push_back(stack[i].sym);
+
+  std::map<std::vector<int>, int>::iterator it = stack_ids.find(s);
+  if(it != stack_ids.end()) {
+    stack_id = it->second;
+    return;
+  }
+
+  stack_id = stacks.size();
+  stacks.push_back(s);
+  stack_ids[s] = stack_id;
+}
+
+void rom_profiler::write_flat(FILE *f) const {
+  // the self time is the time spent in a symbol itself, the total
+  // time includes everything called from it
+  std::vector<uint64_t> self(symbols.size(), 0), total(symbols.size(), 0);
+  uint64_t sum = 0;
+
+  for(auto &c : cycles) {
+    const std::vector<int> &s = stacks[c.first.first];
+    std::set<int> seen(s.begin(), s.end());
+    seen.insert(c.first.second);
+
+    self[c.first.second] += c.second;
+    for(int i : seen)
+      total[i] += c.second;
+    sum += c.second;
+  }
+
+  std::vector<int> order;
+  for(size_t i=0;i<symbols.size();i++)
+    if(total[i]) order.push_back(i);
+  std::sort(order.begin(), order.end(), [&](int a, int b) {
+      return self[a] > self[b] || (self[a] == self[b] && total[a] > total[b]); });
+
+  fprintf(f, "ROM profile, %llu cycles (E, 1MHz)\n\n",
+	  (unsigned long long)sum);
+  fprintf(f, "  self%%      self cycles  total%%     calls  address    symbol\n");
+  for(int i : order)
+    fprintf(f, "%6.2f%% %12llu %6.2f%% %9llu  %04x-%04x  %s\n",
+	    100.0*self[i]/sum, (unsigned long long)self[i], 100.0*total[i]/sum,
+	    (unsigned long long)symbols[i].calls,
+	    symbols[i].start, symbols[i].end, symbols[i].name.c_str());
+}
+
+std::string rom_profiler::stack_name(int id) const {
+  std::string n;
+  for(int s : stacks[id])
+    n += symbols[s].name + ";";
+  return n;
+}
+
+void rom_profiler::write_folded(FILE *f) const {
+  for(auto &c : cycles)
+    if(c.second)
+      fprintf(f, "%s%s %llu\n", stack_name(c.first.first).c_str(),
+	      symbols[c.first.second].name.c_str(), (unsigned long long)c.second);
+}
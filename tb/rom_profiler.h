@@ -0,0 +1,81 @@
+/*
+  rom_profiler.h
+
+  Attributes the cycles the HD6301 spends to the code in its rom.
+  The symbols are the comment lines and labels in rom/IKBD.ASM, each
+  one covering the code from its address up to the next one.
+
+  The cpu's pc and opcode are sampled on every cycle via the debug
+  ports of the model. A shadow call stack is kept from the jsr/bsr
+  instructions and the stack pointer, so the cycles can also be
+  written as collapsed stacks for flame graph tools:
+
+    f13a main loop;f8d4 routine check for commands 1234
+*/
+
+#ifndef ROM_PROFILER_H
+#define ROM_PROFILER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "ikbd_model.h"
+
+class rom_profiler {
+public:
+  rom_profiler();
+
+  // read the symbols from the disassembly
+  bool load_symbols(const char *asm_file);
+
+  // called once per E cycle
+  void sample(const ikbd_model *m) {
+    if(m->dbg_icnt != last_icnt) {
+      last_icnt = m->dbg_icnt;
+      instruction(m->dbg_pc, m->dbg_sp, m->dbg_opcode);
+    }
+    (*cur)++;
+  }
+
+  void write_flat(FILE *f) const;
+  void write_folded(FILE *f) const;
+
+private:
+  struct symbol {
+    uint16_t start, end;
+    std::string name;
+    uint64_t calls;
+  };
+  std::vector<symbol> symbols;
+  uint16_t sym[65536];      // symbol index of every address
+
+  // the shadow call stack. Each frame is the symbol a call or an
+  // interrupt happened in and the stack pointer at the first
+  // instruction of the code called
+  struct frame {
+    uint16_t sp;
+    int sym;
+  };
+  std::vector<frame> stack;
+  std::map<std::vector<int>, int> stack_ids;
+  std::vector<std::vector<int> > stacks;
+  int stack_id;
+
+  // cycles by stack and symbol of the current instruction
+  std::map<std::pair<int,int>, uint64_t> cycles;
+  uint64_t *cur;
+  int cur_sym;
+
+  uint32_t last_icnt;
+  uint16_t last_sp;
+  uint8_t last_op;
+
+  int add_symbol(uint16_t start, const std::string &name);
+  void instruction(uint16_t pc, uint16_t sp, uint8_t op);
+  void stack_changed();
+  std::string stack_name(int id) const;
+};
+
+#endif // ROM_PROFILER_H
@@ -0,0 +1,214 @@
+/*
+  scenario.cpp
+
+  Scenario file parser, see scenario.h for the format
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scenario.h"
+
+#define SEP " \t\r\n"
+
+static bool parse_int(const char *s, int base, int *v) {
+  char *end;
+  if(!s) return false;
+  *v = strtol(s, &end, base);
+  return *s && !*end;
+}
+
+static bool parse_byte(const char *s, int *v) {
+  return parse_int(s, 16, v) && *v >= 0 && *v <= 0xff;
+}
+
+// up+fire, none, ...
+static bool parse_joy(char *s, int *v) {
+  static const struct { const char *name; int bit; } dirs[] = {
+    { "none", NONE }, { "up", UP }, { "down", DOWN }, { "left", LEFT },
+    { "right", RIGHT }, { "fire", FIRE }, { NULL, 0 } };
+
+  char *save;
+  *v = 0;
+  for(char *d = strtok_r(s, "+", &save); d; d = strtok_r(NULL, "+", &save)) {
+    int i;
+    for(i=0;dirs[i].name && strcmp(dirs[i].name, d);i++);
+    if(!dirs[i].name) return false;
+    *v |= dirs[i].bit;
+  }
+  return true;
+}
+
+bool scenario::parse(scenario_event &ev, const char *type, char *args) {
+  char *save, *tok, empty[1] = "";
+  int v;
+
+  if(!args) args = empty;
+
+  if(!strcmp(type, "text")) {
+    ev.type = TTEXT;
+    // the text is the remainder of the line
+    ev.text = args + strspn(args, SEP);
+    ev.text.erase(ev.text.find_last_not_of(SEP) + 1);
+    return true;
+  }
+
+  if(!strcmp(type, "noparse")) {
+    ev.type = TNOPARSE;
+    return true;
+  }
+
+  if(!strcmp(type, "stress")) {
+    ev.type = TSTRESS;
+    if(!parse_int(strtok_r(args, SEP, &save), 10, &v) || v <= 0)
+      return false;
+    ev.io.push_back( { IO_WAIT, v } );
+    // optional idle bits between the bytes
+    if((tok = strtok_r(NULL, SEP, &save))) {
+      if(!parse_int(tok, 10, &v) || v < 0 || strtok_r(NULL, SEP, &save))
+	return false;
+      ev.io.push_back( { IO_GAP, v } );
+    }
+    return true;
+  }
+
+  if(!strcmp(type, "inhibit")) {
+    tok = strtok_r(args, SEP, &save);
+    if(!tok || (strcmp(tok, "k") && strcmp(tok, "m"))) return false;
+    ev.type = strcmp(tok, "k")?TINHM:TINHK;
+    if(!parse_int(strtok_r(NULL, SEP, &save), 10, &v) || v <= 0 ||
+       strtok_r(NULL, SEP, &save))
+      return false;
+    ev.io.push_back( { IO_WAIT, v } );
+    return true;
+  }
+
+  if(!strcmp(type, "ser")) {
+    ev.type = TSER;
+    for(tok = strtok_r(args, SEP, &save); tok; tok = strtok_r(NULL, SEP, &save)) {
+      if(!parse_byte(tok, &v)) return false;
+      ev.io.push_back( { IO_BYTE, v } );
+    }
+    return !ev.io.empty();
+  }
+
+  if(!strcmp(type, "joy")) {
+    ev.type = TJOY;
+    for(tok = strtok_r(args, SEP, &save); tok; tok = strtok_r(NULL, SEP, &save)) {
+      if(!strcmp(tok, "wait")) {
+	if(!parse_int(strtok_r(NULL, SEP, &save), 10, &v) || v < 0) return false;
+	ev.io.push_back( { IO_WAIT, v } );
+      } else {
+	int port, dirs;
+	if(!parse_int(tok, 10, &port) || port < 0 || port > 1) return false;
+	if(!(tok = strtok_r(NULL, SEP, &save)) || !parse_joy(tok, &dirs)) return false;
+	ev.io.push_back( { IO_JOY, (port?0x80:0) | dirs } );
+      }
+    }
+    return !ev.io.empty();
+  }
+
+  if(!strcmp(type, "ps2k") || !strcmp(type, "ps2m")) {
+    ev.type = strcmp(type, "ps2k")?TPS2M:TPS2K;
+    for(tok = strtok_r(args, SEP, &save); tok; tok = strtok_r(NULL, SEP, &save)) {
+      if(!strcmp(tok, "pause")) {
+	// a pause can only follow a byte
+	if(ev.io.empty() || !parse_int(strtok_r(NULL, SEP, &save), 10, &v) || v < 0)
+	  return false;
+	if(ev.io.back().op == IO_PAUSE) ev.io.back().value += v;
+	else                            ev.io.push_back( { IO_PAUSE, v } );
+      } else if(!strcmp(tok, "mouse")) {
+	// buttons, x and y of a ps2 mouse packet. ps2.sv expects the
+	// four byte packets of a wheel mouse, the wheel doesn't move.
+	// x and y are 9 bit two's complement
+	int b = 0, x, y;
+	if(!(tok = strtok_r(NULL, SEP, &save))) return false;
+	for(;*tok;tok++) {
+	  if(*tok == 'L')      b |= 0x01;
+	  else if(*tok == 'R') b |= 0x02;
+	  else if(*tok == 'M') b |= 0x04;
+	  else if(*tok != '-') return false;
+	}
+	if(!parse_int(strtok_r(NULL, SEP, &save), 10, &x) ||
+	   !parse_int(strtok_r(NULL, SEP, &save), 10, &y) ||
+	   x < -256 || x > 255 || y < -256 || y > 255)
+	  return false;
+	ev.io.push_back( { IO_BYTE, ((y&0x100)?0x20:0x00)|((x&0x100)?0x10:0x00)|0x08|b } );
+	ev.io.push_back( { IO_BYTE, x&0xff } );
+	ev.io.push_back( { IO_BYTE, y&0xff } );
+	ev.io.push_back( { IO_BYTE, 0 } );
+      } else {
+	if(!parse_byte(tok, &v)) return false;
+	ev.io.push_back( { IO_BYTE, v } );
+      }
+    }
+    return !ev.io.empty();
+  }
+
+  return false;
+}
+
+bool scenario::load(const char *filename) {
+  FILE *f = fopen(filename, "r");
+  if(!f) {
+    printf("Unable to open scenario %s\n", filename);
+    return false;
+  }
+
+  // name is the file name without path and extension
+  name = filename;
+  if(name.rfind('/') != std::string::npos) name.erase(0, name.rfind('/')+1);
+  if(name.rfind('.') != std::string::npos) name.erase(name.rfind('.'));
+
+  char buf[1024];
+  int lineno = 0, first = 0;
+  std::string line;
+  bool ok = true;
+
+  while(ok && fgets(buf, sizeof(buf), f)) {
+    lineno++;
+    if(line.empty()) first = lineno;
+    line += buf;
+
+    // join lines ending with a backslash
+    size_t end = line.find_last_not_of(SEP);
+    if(end != std::string::npos && line[end] == '\\') {
+      line.erase(end);
+      line += ' ';
+      continue;
+    }
+
+    char *save, *s = &line[0];
+    char *tok = strtok_r(s, SEP, &save);
+
+    if(tok && *tok != '#') {
+      int v;
+      if(!strcmp(tok, "runtime"))
+	ok = parse_int(strtok_r(NULL, SEP, &save), 10, &runtime_ms) &&
+	  runtime_ms > 0 && !strtok_r(NULL, SEP, &save);
+      else if(!parse_int(tok, 10, &v) || v <= 0)
+	ok = false;
+      else if(!events.empty() && v < events.back().time) {
+	printf("%s:%d: events not sorted by time\n", filename, first);
+	fclose(f);
+	return false;
+      } else {
+	scenario_event ev;
+	ev.time = v;
+	const char *type = strtok_r(NULL, SEP, &save);
+	ok = type && parse(ev, type, strtok_r(NULL, "", &save));
+	if(ok) events.push_back(ev);
+      }
+    }
+
+    line.clear();
+  }
+  fclose(f);
+
+  if(!ok) {
+    printf("%s:%d: syntax error\n", filename, first);
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,88 @@
+/*
+  scenario.h
+
+  A test scenario as read from a text file. Each line starts with
+  the time in ms an event is to happen at, followed by the event type
+  and its arguments:
+
+    # comment
+    runtime 400                          total simulation time in ms
+    80  text Test relative mouse         print a message
+    80  noparse                          don't decode ikbd replies
+    90  ser 80 01                        send bytes (hex) to the ikbd
+    100 joy 1 up+fire wait 200 1 none    set joystick 0/1, wait ms
+    100 ps2k 12 pause 50 f0 12           ps2 keyboard bytes (hex), pause ms
+    100 ps2m mouse L 10 -20              ps2 mouse bytes, mouse packet
+    100 inhibit k 2                      host holds the ps2 clock (k/m) low
+    100 stress 500 3                     random commands for 500ms, 3 idle bits
+
+  The directions and buttons of a joystick are up, down, left, right
+  and fire joined by '+' or none. The buttons of a mouse packet are
+  any of L, R and M or - for none. Long lines can be continued with
+  a trailing backslash. The idle bits of a stress event are optional
+  and -G overrides them. Events must be sorted by time. Bytes sent
+  while the serial line or a ps2 device is busy are queued behind
+  those before.
+*/
+
+#ifndef SCENARIO_H
+#define SCENARIO_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// event types
+#define TSER    0
+#define TJOY    1
+#define TTEXT   2
+#define TPS2K   3
+#define TPS2M   4
+#define TNOPARSE 5
+#define TSTRESS 6
+#define TINHK   7
+#define TINHM   8
+
+// joystick bits
+#define NONE  (0)
+#define UP    (1<<0)
+#define DOWN  (1<<1)
+#define LEFT  (1<<2)
+#define RIGHT (1<<3)
+#define FIRE  (1<<4)
+
+// steps of the serial, joystick and ps2 sequences
+#define IO_BYTE   0   // serial or ps2 byte
+#define IO_JOY    1   // joystick state, port in bit 7
+#define IO_WAIT   2   // joystick wait, stress or inhibit time in ms
+#define IO_PAUSE  3   // ps2 pause in ms
+#define IO_GAP    4   // stress idle bits between the bytes
+
+struct io_step {
+  uint8_t op;
+  int value;
+};
+
+struct scenario_event {
+  int time;           // in ms
+  int type;
+  std::string text;
+  std::vector<io_step> io;
+};
+
+class scenario {
+public:
+  scenario() : runtime_ms(200) { }
+
+  // returns false and prints the reason if the file cannot be used
+  bool load(const char *filename);
+
+  std::string name;
+  int runtime_ms;
+  std::vector<scenario_event> events;
+
+private:
+  bool parse(scenario_event &ev, const char *type, char *args);
+};
+
+#endif // SCENARIO_H
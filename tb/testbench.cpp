@@ -0,0 +1,926 @@
+/*
+  testbench.cpp
+
+  Scenario driven ikbd testbench, see testbench.h
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "testbench.h"
+#include "ikbd_sim.h"
+#include "lockstep.h"
+
+// == Port usage ==
+// P20: Output: 0 when mouse/joy direction is to be read, 0 for keyboard scan
+// P21: Input: Left mouse button and joystick 0 fire button
+// P22: Input: Right mouse button and joystick 1 fire button
+// P23: SCI RX
+// P24: SCI TX
+
+// P10-P17: Input: Row data
+// P31-P37: Output: Column select
+// P40-P47: Output: Column select
+
+// P30: Unused, in some schematics used as a caps lock led output
+
+// P1 usage for mouse/joystick directions:
+// P10-0U, P11-0D, P12-0L, P13-0R, P14-1U, P15-1D, P16-1L, P17-1R
+// P3/P4 must be 0xff to avoid conflicts with pressed keys
+
+// messages at least this long are downloads, their throughput is
+// reported
+#define DOWNLOAD_MIN  16
+
+
+testbench::testbench(const char *model, const scenario &sc, FILE *out) :
+  rtl(NULL), tickcount(0), scen(sc), out(out), prof(NULL), cov(NULL), turbo(1),
+  ff(false), ff_cycles(0),
+#if VM_TRACE
+  trace(NULL), trace_start(0), trace_stop(UINT64_MAX),
+#endif
+  flight(NULL), replay(NULL), capture(NULL),
+  wakeup_seq(0), ref(out),
+  ikbd_parse(1), rxsr(0), rxcnt(0), rx_start(0), rx_tpb(0), rx_state(0), rx_msg_cnt(0),
+  rx_mouse_x(0), rx_mouse_y(0),
+  gap_set(false), st(0), st_start(0), tx_tpb(0), cosim(NULL), cosim_quantum(0),
+  wt(0), wp(NULL), wc(0),
+  caps(1), tdre(1), orfe(0),
+  event_next(0), event_due(UINT64_MAX), profile_count(0) {
+
+  ps2_release_at[0] = ps2_release_at[1] = 0;
+
+  if(!strcmp(model, "sim"))
+    tb = new ikbd_sim;
+  else if(!strcmp(model, "lockstep"))
+    tb = new ikbd_lockstep(rtl = new ikbd_rtl, new ikbd_sim, &tickcount, out);
+  else
+    tb = rtl = new ikbd_rtl;
+}
+
+testbench::~testbench() {
+#if VM_TRACE
+  if(trace) {
+    trace->close();
+    delete trace;
+  }
+#endif
+  delete cosim;
+  delete flight;
+  delete replay;
+  delete capture;
+  delete tb;
+}
+
+bool testbench::model_valid(const char *model) {
+  return !strcmp(model, "rtl") || !strcmp(model, "sim") || !strcmp(model, "lockstep");
+}
+
+bool testbench::trace_open(const trace_config &cfg) {
+#if VM_TRACE
+  // only the verilated model can be traced
+  if(!rtl) {
+    fprintf(out, "Tracing needs the rtl model\n");
+    return false;
+  }
+
+  rtl->ctx->traceEverOn(true);
+  trace = new trace_t;
+
+  // limit the signals to be traced. The trace names all start
+  // with TOP.ikbd
+  for(size_t i=0;i<cfg.scopes.size();i++)
+    trace->dumpvars(cfg.depth, std::string("TOP.ikbd.") + cfg.scopes[i]);
+  if(cfg.scopes.empty() && cfg.depth != 99)
+    trace->dumpvars(cfg.depth, "TOP.ikbd");
+
+  rtl->top->trace(trace, cfg.depth);
+  trace->open(cfg.file);
+  trace_start = cfg.start;
+  trace_stop = cfg.stop;
+  return true;
+#else
+  fprintf(out, "Tracing not compiled in, rebuild with TRACE=vcd or TRACE=fst\n");
+  return false;
+#endif
+}
+
+void testbench::wakeup_run() {
+  while(!wakeups.empty() && wakeups.top().time <= tickcount) {
+    void (testbench::*func)(void) = wakeups.top().func;
+    wakeups.pop();
+    (this->*func)();
+  }
+}
+
+void testbench::serial_rx() {
+  if(rxcnt > 1) {
+    rxsr >>= 1;
+    if(tb->tx)
+      rxsr |= 0x80;
+  } else if(tb->tx) {
+    char desc[100] = "";
+    if(ikbd_parse) {
+      if(rx_msg_cnt == 0) {
+	switch(rxsr) {
+	case 0xf0:
+	  sprintf(desc, " => BOOT OK V0 or KEY RELEASE KEYPAD-0");
+	  break;
+	case 0xf1:
+	  sprintf(desc, " => BOOT OK V1 or KEY RELEASE KEYPAD-.");
+	  break;
+	case 0xf6:
+	  sprintf(desc, " => STATUS REPLY");
+	  rx_state = 0xf6; rx_msg_cnt = 7;
+	  if(stress.start) stress.replies++;
+	  break;
+	case 0xf7:
+	  sprintf(desc, " => MOUSE ABS");
+	  rx_state = 0xf7; rx_msg_cnt = 5;
+	  break;
+	case 0xf8:
+	case 0xf9:
+	case 0xfa:
+	case 0xfb:
+	  lat.report(LAT_MOUSE, rx_start);
+	  rx_state = 0xf8; rx_msg_cnt = 2;
+	  sprintf(desc, " => MOUSE REL L:%s R:%s", rxsr&2?"on":"off",
+		  rxsr&1?"on":"off");
+	  break;
+	case 0xfc:
+	  sprintf(desc, " => TIME OF DAY");
+	  rx_state = 0xfc; rx_msg_cnt = 6;
+	  if(stress.start) stress.replies++;
+	  break;
+	case 0xfd:
+	  lat.report(LAT_JOY, rx_start);
+	  sprintf(desc, " => JOYSTICK");
+	  rx_state = 0xfd; rx_msg_cnt = 2;
+	  break;
+	case 0xfe:
+	  lat.report(LAT_JOY, rx_start);
+	  sprintf(desc, " => JOYSTICK 0");
+	  rx_state = 0xfe; rx_msg_cnt = 1;
+	  break;
+	case 0xff:
+	  lat.report(LAT_JOY, rx_start);
+	  sprintf(desc, " => JOYSTICK 1");
+	  rx_state = 0xff; rx_msg_cnt = 1;
+	  break;
+	default:
+	  lat.report(LAT_KEY, rx_start);
+	  if(rxsr & 0x80) sprintf(desc, " => KEY RELEASE(%02x)", rxsr & 0x7f);
+	  else            sprintf(desc, " => KEY PRESS(%02x)", rxsr & 0x7f);
+	}
+      } else {
+	switch(rx_state) {
+	case 0xf6:  // status report
+	  sprintf(desc, " => ST(%d)=%02x", 7-rx_msg_cnt, rxsr);
+	  break;
+	case 0xf7:  // absolute mouse report
+	  switch(rx_msg_cnt) {
+	  case 5:
+	    sprintf(desc, " => MOUSE BTN %1x", rxsr % 0x0f);
+	    break;
+	  case 4:
+	    rx_mouse_x = rxsr;
+	    break;
+	  case 3:
+	    rx_mouse_x = rx_mouse_x * 256 + rxsr;
+	    sprintf(desc, " => MOUSE X=%d", rx_mouse_x);
+	    break;
+	  case 2:
+	    rx_mouse_y = rxsr;
+	    break;
+	  case 1:
+	    rx_mouse_y = rx_mouse_y * 256 + rxsr;
+	    sprintf(desc, " => MOUSE Y=%d", rx_mouse_y);
+	    break;
+	  }
+	  break;
+	case 0xf8:  // relative mouse report
+	  if(rx_msg_cnt == 2) {
+	    rx_mouse_x += (char)rxsr;
+	    sprintf(desc, " => MOUSE X %d=%d", (char)rxsr, rx_mouse_x);
+	  }
+	  if(rx_msg_cnt == 1) {
+	    rx_mouse_y += (char)rxsr;
+	    sprintf(desc, " => MOUSE Y %d=%d", (char)rxsr, rx_mouse_y);
+	  }
+	  break;
+	case 0xfc: {  // time of day
+	  char name[][6] = { "SEC", "MIN", "HOUR", "DAY", "MONTH", "YEAR" };
+	  sprintf(desc, " => %s %02x", name[rx_msg_cnt-1], rxsr);
+	} break;
+	case 0xfd: // joystick
+	  sprintf(desc, " => JOY(%d), F:%s D:%1x", 2-rx_msg_cnt, (rxsr&0x80)?"on ":"off",rxsr&0xf);
+	  break;
+
+	default:
+	  break;
+	}
+
+	rx_msg_cnt--;
+      }
+    }
+    fprintf(out, "@%.2fµs IKBD RX %02x%s\n", tickcount/1000.0, rxsr, desc);
+    uint64_t errors = ref.errors();
+    ref.rx(rxsr, rx_start);
+    if(flight && ref.errors() != errors) flight_trigger("unexpected reply");
+    if(cosim) cosim->send(COSIM_BYTE, rxsr, tickcount);
+  }
+
+  // sample the next bit
+  if(--rxcnt)
+    wakeup_at(tickcount + rx_tpb, &testbench::serial_rx);
+}
+
+
+// check for a start bit on the ikbds tx line
+inline void testbench::serial_rx_check() {
+  if(!tb->tx && !rxcnt) {
+    // make sure we sample in the middle of the bit
+    rxcnt = 10;
+    rxsr = 0;
+    rx_start = tickcount;
+    rx_tpb = sci_tpb(tb->dbg_rmcr);
+    lat.report(LAT_TX, tickcount);
+    wakeup_at(tickcount + rx_tpb/2, &testbench::serial_rx);
+  }
+}
+
+// serial transmission to the ikbd
+void testbench::serial_do() {
+  // idle or outdated wakeup
+  if(!uart.busy() || tickcount < st) return;
+
+  if(uart.start_bit()) {
+    if(uart.msg_first()) st_start = tickcount;
+    tx_tpb = sci_tpb(tb->dbg_rmcr);
+    fprintf(out, "@%.2fµs IKBD TX %02x\n", tickcount/1000.0, uart.byte());
+  }
+
+  // the ikbd has the byte with its stop bit
+  if(uart.stop_bit())
+    ref.command(uart.byte(), tickcount);
+
+  // drive ikbds rx line
+  size_t done;
+  tb->rx = uart.next(&done);
+
+  if(done >= DOWNLOAD_MIN) {
+    double ms = (tickcount + tx_tpb - st_start) / 1000000.0;
+    fprintf(out, "@%.2fµs IKBD TX %d bytes in %.2fms = %.0f bytes/s at %.1f bit/s\n",
+	    tickcount/1000.0, (int)done, ms, done * 1000.0 / ms, 1e9 / tx_tpb);
+  }
+
+  if(tickcount < stress.end) stress_fill();
+  else if(stress.end && !stress.done && !uart.busy())
+    stress.done = tickcount + tx_tpb;
+
+  if(uart.busy())
+    wakeup_at(st = tickcount + tx_tpb, &testbench::serial_do);
+}
+
+// a message is queued behind those still being sent
+void testbench::serial_start(const std::vector<io_step> *msg) {
+  std::vector<uint8_t> data;
+  for(size_t i=0;i<msg->size();i++)
+    data.push_back((*msg)[i].value);
+  serial_send(data.data(), data.size());
+}
+
+void testbench::serial_send(const uint8_t *data, size_t len) {
+  bool idle = !uart.busy();
+  uart.send(data, len);
+  if(idle) {
+    st = tickcount;
+    serial_do();
+  }
+}
+
+// ========= flight recorder =========
+void testbench::flight_record(uint64_t window_ns, const std::vector<std::string> &triggers, const char *dir) {
+  delete flight;
+  flight = new flight_recorder(window_ns);
+  for(size_t i=0;i<triggers.size();i++)
+    flight->trigger_add(triggers[i]);
+  flight_file = std::string(dir) + "/" + scen.name + ".flight.vcd";
+}
+
+// only the first trigger is written, the recorder isn't needed after
+// that
+void testbench::flight_trigger(const char *reason) {
+  fprintf(out, "@%.2fµs FLIGHT %s, ", tickcount/1000.0, reason);
+  if(flight->write(flight_file.c_str(), tickcount))
+    fprintf(out, "last %.2fms written to %s\n", flight->window/1000000.0, flight_file.c_str());
+  else
+    fprintf(out, "unable to write %s\n", flight_file.c_str());
+
+  delete flight;
+  flight = NULL;
+}
+
+// ========= pin captures =========
+bool testbench::replay_open(const char *file) {
+  replay = new capture_reader;
+  if(replay->open(file)) return true;
+
+  fprintf(out, "Unable to read capture %s\n", file);
+  return false;
+}
+
+bool testbench::capture_open(const char *file) {
+  capture = new capture_writer;
+  if(capture->open(file)) return true;
+
+  fprintf(out, "Unable to write capture %s\n", file);
+  return false;
+}
+
+// The pins only change at the edges in the capture, so it's only
+// looked at then. Edges before a restored snapshot are all applied
+// at once
+void testbench::replay_do() {
+  capture_apply(tb, replay->state);
+  if(replay->next())
+    wakeup_at(replay->time, &testbench::replay_do);
+}
+
+// ========= co-simulation =========
+bool testbench::cosim_open(const char *path, uint64_t quantum_ns) {
+  cosim = new cosim_link;
+  cosim_quantum = quantum_ns;
+
+  fprintf(out, "Waiting for the acia emulator on %s\n", path);
+  fflush(out);
+  if(!cosim->listen(path)) {
+    fprintf(out, "No acia emulator connected\n");
+    return false;
+  }
+
+  cosim_msg m;
+  cosim->send(COSIM_HELLO, COSIM_VERSION, quantum_ns);
+  if(!cosim->flush() || !cosim->recv(&m) || m.type != COSIM_HELLO || m.data != COSIM_VERSION) {
+    fprintf(out, "The acia emulator doesn't speak version %d\n", COSIM_VERSION);
+    return false;
+  }
+  return true;
+}
+
+// Everything up to now was sent, wait for the acia to get here as
+// well. The bytes it sent meanwhile are started a quantum later
+void testbench::cosim_sync() {
+  if(!cosim) return;
+
+  cosim->send(COSIM_SYNC, 0, tickcount);
+  cosim_msg m;
+  bool ok = cosim->flush();
+  while(ok && (ok = cosim->recv(&m))) {
+    if(m.type == COSIM_BYTE) {
+      m.time += cosim_quantum;
+      cosim_rx.push_back(m);
+      wakeup_at(m.time, &testbench::cosim_deliver);
+    }
+    if(m.type == COSIM_END) {
+      fprintf(out, "@%.2fµs COSIM acia stopped at %.2fµs\n", tickcount/1000.0, m.time/1000.0);
+      ok = false;
+    }
+    if(m.type == COSIM_SYNC && m.time >= tickcount)
+      break;
+  }
+
+  if(!ok) {
+    delete cosim;
+    cosim = NULL;
+    return;
+  }
+  wakeup_at(tickcount + cosim_quantum, &testbench::cosim_sync);
+}
+
+void testbench::cosim_deliver() {
+  while(!cosim_rx.empty() && cosim_rx.front().time <= tickcount) {
+    fprintf(out, "@%.2fµs COSIM acia sent %02x\n", tickcount/1000.0, cosim_rx.front().data);
+    serial_send(&cosim_rx.front().data, 1);
+    cosim_rx.pop_front();
+  }
+}
+
+// ========= stress test =========
+// Valid commands which don't change what the ikbd reports. Their
+// parameters are no command codes, so a lost byte can't turn one
+// into e.g. a memory load or a reset. A query is only sent after
+// at least as many bytes as its reply has, so the rom's output
+// buffer can't overflow and every missing reply is a byte lost on
+// the way in
+#define STRESS_QUERIES 4
+static const uint8_t stress_queries[STRESS_QUERIES] = {
+  0x1c,   // interrogate time of day
+  0x87,   // mouse button action status
+  0x8b,   // mouse threshold status
+  0x8c    // mouse scale status
+};
+
+static uint32_t xorshift(uint32_t *s) {
+  *s ^= *s << 13;
+  *s ^= *s >> 17;
+  *s ^= *s << 5;
+  return *s;
+}
+
+void testbench::stress_fill() {
+  // keep at least one byte behind the one being sent, so the line
+  // never idles for longer than the gap
+  while(uart.queued() < 2) {
+    uint8_t cmd[3];
+    int len = 1;
+    uint32_t r = xorshift(&stress.seed);
+
+    if(stress.credit >= 8 && (r & 3) == 0) {
+      cmd[0] = stress_queries[(r >> 2) % STRESS_QUERIES];
+      stress.credit = 0;
+      stress.queries++;
+    } else {
+      switch((r >> 2) % 5) {
+      case 0:  // set mouse button action
+	cmd[0] = 0x07; cmd[1] = (r >> 8) % 3; len = 2;
+	break;
+      case 1:  // set relative mouse position reporting
+	cmd[0] = 0x08;
+	break;
+      case 2:  // set mouse threshold, $23 to $7e
+	cmd[0] = 0x0b; cmd[1] = 0x23 + (r >> 8) % 92; cmd[2] = 0x23 + (r >> 16) % 92; len = 3;
+	break;
+      case 3:  // set mouse scale
+	cmd[0] = 0x0c; cmd[1] = 0x23 + (r >> 8) % 92; cmd[2] = 0x23 + (r >> 16) % 92; len = 3;
+	break;
+      case 4:  // resume
+	cmd[0] = 0x11;
+	break;
+      }
+      stress.credit += len;
+    }
+
+    uart.send(cmd, len);
+    stress.commands++;
+    stress.bytes += len;
+  }
+}
+
+void testbench::stress_start(int ms) {
+  fprintf(out, "@%.2fµs STRESS for %dms, gap %d bits\n", tickcount/1000.0, ms, uart.gap);
+  if(!stress.start) stress.start = tickcount;
+  stress.end = tickcount + 1000000ull*ms;
+  stress.done = 0;
+
+  bool idle = !uart.busy();
+  stress_fill();
+  if(idle) {
+    st = tickcount;
+    serial_do();
+  }
+}
+
+// the replies of the last queries may still be missing if the
+// scenario ends right after the stress test. Fails the scenario
+// unless every query got exactly one reply and no byte was lost
+bool testbench::stress_print() {
+  if(!stress.start) return true;
+
+  uint64_t end = stress.done?stress.done:tickcount;
+  double ms = (end - stress.start) / 1000000.0;
+  fprintf(out, "Stress: %llu commands, %llu bytes in %.2fms = %.0f commands/s, %.0f bytes/s, gap %d\n",
+	  (unsigned long long)stress.commands, (unsigned long long)stress.bytes, ms,
+	  stress.commands * 1000.0 / ms, stress.bytes * 1000.0 / ms, uart.gap);
+  fprintf(out, "  %llu queries, %llu replies, %llu ORFE: %s\n",
+	  (unsigned long long)stress.queries, (unsigned long long)stress.replies,
+	  (unsigned long long)stress.orfe,
+	  stress.orfe?"BYTES LOST":
+	  stress.replies < stress.queries?"REPLIES MISSING":
+	  stress.replies > stress.queries?"EXTRA REPLIES":"all commands handled");
+  return !stress.orfe && stress.replies == stress.queries;
+}
+
+void testbench::joystick_do() {
+  // not active or outdated wakeup
+  if(!wp || tickcount < wt) return;
+
+  while(wp && tickcount >= wt) {
+    const io_step &s = (*wp)[wc++];
+    if(s.op == IO_JOY) {
+      fprintf(out, "@%.2fµs JOY(%d,%02x)\n", tickcount/1000.0, (s.value&0x80)?1:0, s.value&0x7f);
+      if(s.value & 0x80) tb->joystick1 = s.value & 0x7f;
+      else               tb->joystick0 = s.value & 0x7f;
+      ref.joystick((s.value&0x80)?1:0, s.value & 0x7f, tickcount);
+      lat.stimulus(LAT_JOY, tickcount);
+    } else if(s.op == IO_WAIT)
+      wt = tickcount + 1000000ull*s.value;
+
+    // DONE ?  
+    if(wc == wp->size())
+      wp = NULL;
+  }
+
+  if(wp) wakeup_at(wt, &testbench::joystick_do);
+}
+
+void testbench::joystick_start(const std::vector<io_step> *msg) {
+  wc = 0;
+  wp = msg;
+  wt = tickcount;
+  joystick_do();
+}
+
+inline void testbench::caps_check() {
+  if(tb->caps_lock != caps) {
+    caps = tb->caps_lock;
+    fprintf(out, "@%.2fµs CAPS LOCK changed to %d!\n", tickcount/1000.0, caps);
+  }
+}
+
+// TDRE is cleared when the rom writes a byte into TDR and set again
+// when its start bit goes out. ORFE is set by a byte received while
+// RDRF is still set, which is then lost, or by a missing stop bit
+inline void testbench::sci_check() {
+  uint8_t t = (tb->dbg_trcsr >> 5) & 1;
+  if(tdre && !t)
+    lat.stimulus(LAT_TX, tickcount);
+  tdre = t;
+
+  uint8_t e = (tb->dbg_trcsr >> 6) & 1;
+  if(e && !orfe) {
+    fprintf(out, "@%.2fµs IKBD ORFE %s\n", tickcount/1000.0,
+	    (tb->dbg_trcsr & 0x80)?"overrun":"framing error");
+    if(stress.start) stress.orfe++;
+    ref.stop(tickcount, "the sci lost a byte");
+    if(flight) flight_trigger("ORFE");
+  }
+  orfe = e;
+}
+
+static const char *ps2_name[2] = { "PS2K", "PS2M" };
+
+// the host's inhibit pulls the clock low whatever the device drives
+void testbench::ps2_lines(int dev) {
+  const ps2_device &d = ps2[dev];
+  uint8_t clk = d.clk && !d.inhibited;
+  if(dev) { tb->ps2_mouse_clk = clk; tb->ps2_mouse_data = d.data; }
+  else    { tb->ps2_kbd_clk = clk;   tb->ps2_kbd_data = d.data; }
+}
+
+void testbench::ps2_do(int dev) {
+  ps2_device &d = ps2[dev];
+
+  // ignore outdated wakeups
+  if(tickcount < d.due) return;
+
+  switch(d.run(tickcount)) {
+  case PS2_START:
+    fprintf(out, "@%.2fµs %s TX %02x\n", tickcount/1000.0, ps2_name[dev], d.byte());
+    break;
+
+  case PS2_SENT: {
+    // the ikbd has the byte after the falling edge of the stop bit. A
+    // key event ends with the first byte that's not a prefix, a mouse
+    // event with its last byte
+    int b = d.byte();
+    if(!dev && b != 0xe0 && b != 0xe1 && b != 0xf0)
+      lat.stimulus(LAT_KEY, tickcount);
+    if(dev && d.last())
+      lat.stimulus(LAT_MOUSE, tickcount);
+    ref.ps2_byte(dev, b, tickcount);
+  } break;
+  }
+
+  ps2_lines(dev);
+  if(d.due != UINT64_MAX)
+    wakeup_at(d.due, dev?&testbench::ps2_mouse_do:&testbench::ps2_kbd_do);
+}
+
+// a message is queued behind those the device is still sending
+void testbench::ps2_start(int dev, const std::vector<io_step> *msg) {
+  bool idle = !ps2[dev].busy();
+  ps2[dev].send(*msg, tickcount);
+  if(idle) ps2_do(dev);
+}
+
+// the host holds the clock low for ms
+void testbench::ps2_inhibit(int dev, int ms) {
+  ps2_device &d = ps2[dev];
+  fprintf(out, "@%.2fµs %s INHIBIT %dms\n", tickcount/1000.0, ps2_name[dev], ms);
+  if(d.inhibit() == PS2_ABORT) {
+    fprintf(out, "@%.2fµs %s TX %02x aborted\n", tickcount/1000.0, ps2_name[dev], d.byte());
+    ref.stop(tickcount, "a ps2 byte was aborted");
+  }
+  ps2_lines(dev);
+
+  ps2_release_at[dev] = tickcount + 1000000ull*ms;
+  wakeup_at(ps2_release_at[dev], dev?&testbench::ps2_mouse_release:&testbench::ps2_kbd_release);
+}
+
+void testbench::ps2_release(int dev) {
+  ps2_device &d = ps2[dev];
+
+  // ignore the release of an inhibit extended by a later one
+  if(!d.inhibited || tickcount < ps2_release_at[dev]) return;
+
+  fprintf(out, "@%.2fµs %s RELEASE\n", tickcount/1000.0, ps2_name[dev]);
+  d.release(tickcount);
+  ps2_lines(dev);
+  if(d.due != UINT64_MAX)
+    wakeup_at(d.due, dev?&testbench::ps2_mouse_do:&testbench::ps2_kbd_do);
+}
+
+// events are started in the order of their time. They are checked
+// after the transactors ran, so a transactor finishing at the time
+// a new event restarts it still completes
+void testbench::event_do() {
+  while(event_next < scen.events.size() && 1000000ull*scen.events[event_next].time <= tickcount) {
+    const scenario_event &ev = scen.events[event_next++];
+    
+    if(ev.type == TSER)
+      serial_start(&ev.io);
+    if(ev.type == TSTRESS) {
+      ref.stop(tickcount, "random commands of the stress test");
+      if(ev.io.size() > 1 && !gap_set) uart.gap = ev.io[1].value;
+      stress_start(ev.io[0].value);
+    }
+    if(ev.type == TJOY)
+      joystick_start(&ev.io);
+    if(ev.type == TTEXT)
+      fprintf(out, "@%.2fµs %s\n", tickcount/1000.0, ev.text.c_str());
+    if(ev.type == TPS2K)
+      ps2_start(0, &ev.io);
+    if(ev.type == TPS2M)
+      ps2_start(1, &ev.io);
+    if(ev.type == TINHK)
+      ps2_inhibit(0, ev.io[0].value);
+    if(ev.type == TINHM)
+      ps2_inhibit(1, ev.io[0].value);
+    // this test sets the ikbd in a special report mode where the
+    // reply should not be parsed as usual
+    if(ev.type == TNOPARSE)
+      ikbd_parse = 0;
+  }
+
+  event_due = (event_next < scen.events.size())?1000000ull*scen.events[event_next].time:UINT64_MAX;
+}
+
+void testbench::event_init() {
+  // skip events that have passed already, e.g. in a restored snapshot
+  while(event_next < scen.events.size() && 1000000ull*scen.events[event_next].time <= tickcount)
+    event_next++;
+
+  event_due = (event_next < scen.events.size())?1000000ull*scen.events[event_next].time:UINT64_MAX;
+}
+
+// everything the testbench does after the model was evaluated
+void testbench::tick_tb() {
+#if VM_TRACE
+  if(trace && tickcount >= trace_start) {
+    if(tickcount < trace_stop)
+      trace->dump(tickcount);
+    else {
+      // end of window, no need to pay for tracing anymore
+      trace->close();
+      delete trace;
+      trace = NULL;
+    }
+  }
+#endif
+  if(flight) {
+    const char *reason = flight->sample(tickcount, tb);
+    if(reason) flight_trigger(reason);
+  }
+  if(capture) capture->sample(tickcount, capture_pins(tb));
+  tickcount += 250; // 2*250ns/cycle -> 2MHz, matching a real 6301@4MHz
+
+  // the ikbd outputs are watched all the time, everything else only
+  // runs when it's due
+  serial_rx_check();
+  caps_check();
+  sci_check();
+  wakeup_run();
+  if(tickcount >= event_due) event_do();
+}
+
+static inline uint64_t ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void testbench::tick_profiled() {
+  profile_count = PROFILE_STRIDE;
+
+  uint64_t t0 = ns();
+  tb->eval();
+  uint64_t t1 = ns();
+  tick_tb();
+  uint64_t t2 = ns();
+
+  stats.samples++;
+  stats.eval_ns += t1 - t0;
+  stats.transactor_ns += t2 - t1;
+}
+
+void testbench::tick(int c) {
+  // a faster cpu gets its extra clock cycles right before the 2MHz
+  // one with the peripherals disabled. They are neither traced nor
+  // seen by the transactors
+  if(c && turbo > 1) {
+    tb->periph_en = 0;
+    for(int i=1;i<turbo;i++) {
+      tb->clk = 1; tb->eval();
+      tb->clk = 0; tb->eval();
+    }
+    tb->periph_en = 1;
+  }
+
+  tb->clk = c;
+  if(profile_count && !--profile_count) {
+    tick_profiled();
+    return;
+  }
+  tb->eval();
+
+  // E is CLKx2/2, so every other rising edge
+  if((prof || cov) && c && !(tickcount % 1000)) {
+    if(prof) prof->sample(tb);
+    if(cov) cov->sample(tb);
+  }
+
+  tick_tb();
+}
+
+void testbench::ticks(int c) {
+  for(int i=0;i<c;i++) {
+    tick(1);
+    tick(0);
+  }
+}
+
+// ========= boot snapshot =========
+// The testbench itself is idle at the snapshot time, so apart from
+// the time only the model state is needed
+bool testbench::snapshot_possible() {
+  if(!tb->savable()) {
+    fprintf(out, "Model %s was built without snapshot support\n", tb->name());
+    return false;
+  }
+
+  for(size_t i=0;i<scen.events.size();i++) {
+    if(scen.events[i].time <= SNAPSHOT_MS) {
+      fprintf(out, "Event at %dms is not after the snapshot at %dms\n",
+	      scen.events[i].time, SNAPSHOT_MS);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool testbench::snapshot_save(const char *name) {
+  if(uart.busy() || ps2[0].busy() || ps2[1].busy() || wp || rxcnt) {
+    fprintf(out, "Testbench not idle at snapshot time\n");
+    return false;
+  }
+
+  VerilatedSave os;
+  os.open(name);
+  if(!os.isOpen()) {
+    fprintf(out, "Unable to write snapshot %s\n", name);
+    return false;
+  }
+
+  std::string model(tb->name());
+  os << model << tickcount;
+  tb->save(os);
+  os.close();
+
+  fprintf(out, "@%.2fµs saved snapshot %s\n", tickcount/1000.0, name);
+  return true;
+}
+
+bool testbench::snapshot_restore(const char *name) {
+  VerilatedRestore os;
+  os.open(name);
+  if(!os.isOpen()) {
+    fprintf(out, "Unable to read snapshot %s\n", name);
+    return false;
+  }
+
+  std::string model;
+  os >> model >> tickcount;
+  if(model != tb->name()) {
+    fprintf(out, "Snapshot %s is for model %s, not %s\n", name, model.c_str(), tb->name());
+    return false;
+  }
+  tb->restore(os);
+  os.close();
+
+  fprintf(out, "@%.2fµs restored snapshot %s\n", tickcount/1000.0, name);
+  return true;
+}
+
+// Skip the cycles the model can in front of the next wakeup, the
+// next scenario event and limit. Every tick of these would have run
+// with the inputs unchanged and nothing for the transactors to do
+uint64_t testbench::ff_skip(uint64_t limit) {
+  if(event_due < limit) limit = event_due;
+  if(!wakeups.empty() && wakeups.top().time < limit) limit = wakeups.top().time;
+
+  // the ticks of the last cycle skipped must still be before limit
+  uint64_t n = tb->fast_forward(limit > tickcount?(limit - tickcount - 1) / 500:0);
+
+  tickcount += 500 * n;
+  ff_cycles += n;
+  return n;
+}
+
+bool testbench::run(const char *restore_file, const char *save_file) {
+  if((save_file || restore_file) && !snapshot_possible())
+    return false;
+
+  stats.start = tickcount;
+  if(restore_file) {
+    if(!snapshot_restore(restore_file))
+      return false;
+    stats.start = tickcount;
+  } else {
+    // init all signals
+    tb->res = 1;
+
+    // init ps2 keyboard
+    tb->ps2_kbd_clk = 1;
+    tb->ps2_kbd_data = 1;
+
+    // init ps2 mouse
+    tb->ps2_mouse_clk = 1;
+    tb->ps2_mouse_data = 1;
+
+    // init ikbd uart
+    tb->rx = 1;
+
+    tb->joystick0 = 0;
+    tb->joystick1 = 0;
+
+    if(replay) capture_apply(tb, replay->state);
+
+    // apply reset
+    ticks(5);
+    tb->res = 0;
+    fprintf(out, "@%.2fµs out of reset\n", tickcount/1000.0);
+    ref.power_up(tickcount);
+  }
+
+  event_init();
+
+  // the reference model doesn't see the replayed stimuli
+  if(replay) {
+    ref.stop(tickcount, "the input is replayed from a capture");
+    replay_do();
+  }
+
+  // both sides start at the same time
+  cosim_sync();
+
+  if(prof || cov || flight || turbo > 1)
+    ff = false;
+#if VM_TRACE
+  if(trace) ff = false;
+#endif
+
+  // each loop is one 500ns cycle, the reset took the first five. A
+  // restored simulation continues where the snapshot was taken
+  uint64_t end = (2000ull*scen.runtime_ms + 5) * 500;
+  if(save_file) end = SNAPSHOT_MS*1000000ull;
+  for(uint64_t i=tickcount/500-5;i<2000ull*scen.runtime_ms;i++) {
+    tick(1);
+    tick(0);
+
+    if(save_file && tickcount == SNAPSHOT_MS*1000000ull)
+      return snapshot_save(save_file);
+
+    if(ff) i += ff_skip(end);
+  }
+
+  if(cosim) {
+    cosim->send(COSIM_END, 0, tickcount);
+    cosim->flush();
+  }
+
+  bool ok = true;
+  if(capture && !capture->close()) {
+    fprintf(out, "Unable to write the capture\n");
+    ok = false;
+  }
+
+  if(ff)
+    fprintf(out, "fast forward skipped %.1f%% of %.3fms\n",
+	    100.0*ff_cycles*500/(tickcount - stats.start), (tickcount - stats.start)/1000000.0);
+
+  ok = stress_print() && ok;
+  lat.print(out, tickcount);
+  ok = ref.print(tickcount) && ok;
+  return ok && !tb->failed();
+}
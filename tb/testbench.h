@@ -0,0 +1,265 @@
+/*
+  testbench.h
+
+  Runs one scenario on one ikbd model. All state incl. the serial,
+  joystick and ps2 transactors lives in the testbench object, so
+  several of them can run in parallel threads.
+*/
+
+#ifndef TESTBENCH_H
+#define TESTBENCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <deque>
+#include <queue>
+#include <vector>
+#include "ikbd_model.h"
+#include "ikbd_rtl.h"
+#include "scenario.h"
+#include "rom_profiler.h"
+#include "rom_coverage.h"
+#include "latency.h"
+#include "uart.h"
+#include "ps2.h"
+#include "ikbd_ref.h"
+#include "cosim.h"
+#include "flight.h"
+#include "capture.h"
+
+// the trace format is selected at build time, see Makefile. Without
+// tracing compiled in the trace path costs nothing at all
+#if VM_TRACE_FST
+#include "verilated_fst_c.h"
+typedef VerilatedFstC trace_t;
+#elif VM_TRACE
+#include "verilated_vcd_c.h"
+typedef VerilatedVcdC trace_t;
+#endif
+
+// The rom self test and the boot message take the first 66ms. The
+// state right after that is saved and all tests restore from there
+// instead of booting again.
+#define SNAPSHOT_MS 79
+
+struct trace_config {
+  trace_config() : file(NULL), depth(99), start(0), stop(UINT64_MAX) { }
+
+  const char *file;
+  int depth;
+  std::vector<const char*> scopes;
+  uint64_t start, stop;   // time window in ns
+};
+
+class testbench {
+public:
+  // model is one of rtl, sim or lockstep. All output goes to out
+  testbench(const char *model, const scenario &sc, FILE *out);
+  ~testbench();
+
+  static bool model_valid(const char *model);
+
+  bool trace_open(const trace_config &cfg);
+
+  // start the sci transmissions in 11 bit time slots like the
+  // original core instead of on the next bit boundary
+  void sci_tx_slots(bool on) { tb->sci_tx_slots = on; }
+
+  // run the cpu core at n times the 2MHz clock while the timer, the
+  // sci and the ps2 decoder keep their 2MHz timebase
+  void cpu_clock(int n) { turbo = n; }
+
+  // let the model skip idle cycles up to the next event of the
+  // testbench, see ikbd_model::fast_forward. This is off while
+  // tracing, profiling, recording coverage, with the flight recorder
+  // or a faster cpu clock as these need to see every cycle
+  void fast_forward(bool on) { ff = on; }
+
+  // clock of the ps2 devices in kHz and their idle time between
+  // bytes
+  void ps2_timing(double khz, uint64_t idle_ns) {
+    for(int i=0;i<2;i++) {
+      ps2[i].half_ns = ps2_device::half(khz);
+      ps2[i].idle_ns = idle_ns;
+    }
+  }
+
+  // idle bits the uart sends after each byte to the ikbd, 0 is the
+  // full line rate. Overrides the gap a stress event asks for
+  void uart_gap(int bits) { uart.gap = bits; gap_set = true; }
+
+  // sample the cpu's pc into the profiler on every E cycle
+  void rom_profile(rom_profiler *p) { prof = p; }
+
+  // and into the coverage
+  void rom_cover(rom_coverage *c) { cov = c; }
+
+  // wait for an acia emulator to connect to the socket at path and
+  // exchange the serial bytes with it, see cosim.h
+  bool cosim_open(const char *path, uint64_t quantum_ns);
+
+  // keep the last window_ns of the pins in memory and write them to
+  // dir/<scenario>.flight.vcd on the first trigger, see flight.h
+  void flight_record(uint64_t window_ns, const std::vector<std::string> &triggers, const char *dir);
+
+  // drive the inputs from a capture instead of the scenario's
+  // transactors and record all pins into one, see capture.h
+  bool replay_open(const char *file);
+  bool capture_open(const char *file);
+
+  // run the scenario, optionally starting from a snapshot or stopping
+  // at the snapshot time to save one. Returns false on failure
+  bool run(const char *restore_file = NULL, const char *save_file = NULL);
+
+  // every PROFILE_STRIDE'th tick is timed to find out where the
+  // time goes. The stride is prime so it doesn't beat with the
+  // transactor bit times
+  static const int PROFILE_STRIDE = 61;
+  void profile() { profile_count = PROFILE_STRIDE; }
+
+  struct profile_stats {
+    profile_stats() : start(0), samples(0), eval_ns(0), transactor_ns(0) { }
+    uint64_t start;     // simulation time the run started at
+    uint64_t samples;   // number of timed ticks
+    uint64_t eval_ns, transactor_ns;
+  } stats;
+
+  ikbd_model *tb;
+  ikbd_rtl *rtl;    // the verilated model if in use
+  uint64_t tickcount;  // simulation time in ns
+
+private:
+  const scenario &scen;
+  FILE *out;
+  rom_profiler *prof;
+  rom_coverage *cov;
+  int turbo;
+  bool ff;
+  uint64_t ff_cycles;   // cycles skipped
+  uint64_t ff_skip(uint64_t limit);
+
+#if VM_TRACE
+  trace_t *trace;
+  uint64_t trace_start, trace_stop;
+#endif
+
+  flight_recorder *flight;
+  std::string flight_file;
+  void flight_trigger(const char *reason);
+
+  capture_reader *replay;
+  capture_writer *capture;
+  void replay_do();
+
+  // ========= scheduler =========
+  // The transactors don't run on every clock edge but register the
+  // time they next need to act at. Wakeups for the same time run in
+  // the order they were requested in.
+  struct wakeup {
+    uint64_t time;
+    uint32_t seq;
+    void (testbench::*func)(void);
+
+    bool operator>(const wakeup &w) const {
+      return time > w.time || (time == w.time && seq > w.seq);
+    }
+  };
+
+  std::priority_queue<wakeup, std::vector<wakeup>, std::greater<wakeup> > wakeups;
+  uint32_t wakeup_seq;
+
+  void wakeup_at(uint64_t time, void (testbench::*func)(void)) {
+    wakeups.push( { time, wakeup_seq++, func } );
+  }
+  void wakeup_run();
+
+  // input to report latencies
+  latency lat;
+
+  // predicts and checks what the ikbd sends
+  ikbd_ref ref;
+
+  // serial reception from the ikbd
+  int ikbd_parse;
+  int rxsr, rxcnt;
+  uint64_t rx_start;   // time of the start bit
+  uint64_t rx_tpb;     // bit time in ns
+  int rx_state, rx_msg_cnt;
+  int rx_mouse_x, rx_mouse_y;
+  void serial_rx();
+  void serial_rx_check();
+
+  // serial signal generation
+  uart_tx uart;
+  bool gap_set;
+  uint64_t st, st_start, tx_tpb;
+  void serial_do();
+  void serial_start(const std::vector<io_step> *msg);
+  void serial_send(const uint8_t *data, size_t len);
+
+  // co-simulation, bytes from the acia wait in cosim_rx until their
+  // time has come
+  cosim_link *cosim;
+  uint64_t cosim_quantum;
+  std::deque<cosim_msg> cosim_rx;
+  void cosim_sync();
+  void cosim_deliver();
+
+  // stress test, random commands keep the uart busy until end. The
+  // replies to the queries among them tell if the rom lost a byte
+  struct stress_stats {
+    stress_stats() : start(0), end(0), done(0), seed(1), credit(0),
+      commands(0), bytes(0), queries(0), replies(0), orfe(0) { }
+    uint64_t start, end, done;   // time of the event, its end, last stop bit
+    uint32_t seed;
+    int credit;                  // tx bytes free for replies
+    uint64_t commands, bytes, queries, replies, orfe;
+  } stress;
+  void stress_start(int ms);
+  void stress_fill();
+  bool stress_print();
+
+  // wire event generation
+  uint64_t wt;
+  const std::vector<io_step> *wp;
+  size_t wc;
+  void joystick_do();
+  void joystick_start(const std::vector<io_step> *msg);
+
+  // ps2 event generation, device 0 is the keyboard and 1 the mouse.
+  // Both run independently of each other
+  ps2_device ps2[2];
+  uint64_t ps2_release_at[2];
+  void ps2_do(int dev);
+  void ps2_kbd_do() { ps2_do(0); }
+  void ps2_mouse_do() { ps2_do(1); }
+  void ps2_start(int dev, const std::vector<io_step> *msg);
+  void ps2_inhibit(int dev, int ms);
+  void ps2_release(int dev);
+  void ps2_kbd_release() { ps2_release(0); }
+  void ps2_mouse_release() { ps2_release(1); }
+  void ps2_lines(int dev);
+  int caps;
+  uint8_t tdre, orfe;
+  void caps_check();
+  void sci_check();
+
+  // scenario events
+  size_t event_next;
+  uint64_t event_due;
+  void event_do();
+  void event_init();
+
+  int profile_count;  // ticks until the next timed one, 0 = off
+  void tick_tb();
+  void tick_profiled();
+
+  void tick(int c);
+  void ticks(int c);
+
+  bool snapshot_possible();
+  bool snapshot_save(const char *name);
+  bool snapshot_restore(const char *name);
+};
+
+#endif // TESTBENCH_H
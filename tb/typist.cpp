@@ -0,0 +1,390 @@
+/*
+  typist.cpp
+
+  Turns a text into a typing workload for the testbench. Each key is
+  sent as the ps2 scan code set 2 make and break codes ps2.sv
+  decodes, see rom/keymap.hex, and the result is written to stdout
+  as a scenario:
+
+    ./typist -w 80 -o 30 text.txt > typing.scn
+
+  Upper case letters and the shifted symbols of the US layout are
+  typed with the left shift held. Other keys are given by name in
+  braces, e.g. {up}, {kpenter} or {f1}; those behind the 0xe0 prefix
+  are sent with it. A newline is the return key.
+
+  The keys go down at the given words per minute of five characters
+  each with a random jitter and are held for a part of the time to
+  the next one. The overlap is the share of keys still held when the
+  next one goes down, the rollover the most keys held at a time. A
+  key beyond that releases the oldest one held first.
+
+  With -k the input is a recorded keystroke log instead, one key per
+  line with its time in ms and + for the press or - for the release.
+  Only the rollover applies to it:
+
+    0 +shift
+    20 +a
+    95 -a
+    110 -shift
+
+  The testbench's reference model checks what the ikbd reports and
+  counts the keys dropped or reordered, see ikbd_ref.h.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <math.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// codes behind the 0xe0 prefix
+#define EXT    0x100
+#define SHIFT  0x12
+
+// scenario times must come after the boot snapshot, see testbench.h
+#define START_MS  100
+// the most the shift goes down before a key and up after it
+#define LEAD_MS   30
+// the reference model reports keys missing after 100ms
+#define TAIL_MS   200
+
+static const struct {
+  const char *name;
+  int code;
+} names[] = {
+  { "esc", 0x76 }, { "f1", 0x05 }, { "f2", 0x06 }, { "f3", 0x04 }, { "f4", 0x0c },
+  { "f5", 0x03 }, { "f6", 0x0b }, { "f7", 0x83 }, { "f8", 0x0a }, { "f9", 0x01 },
+  { "f10", 0x09 }, { "f11", 0x78 }, { "f12", 0x07 },
+  { "backspace", 0x66 }, { "tab", 0x0d }, { "return", 0x5a }, { "enter", 0x5a },
+  { "space", 0x29 }, { "caps", 0x58 },
+  { "shift", 0x12 }, { "lshift", 0x12 }, { "rshift", 0x59 },
+  { "ctrl", 0x14 }, { "lctrl", 0x14 }, { "rctrl", EXT|0x14 },
+  { "alt", 0x11 }, { "lalt", 0x11 }, { "ralt", EXT|0x11 },
+  { "insert", EXT|0x70 }, { "delete", EXT|0x71 }, { "home", EXT|0x6c }, { "end", EXT|0x69 },
+  { "pgup", EXT|0x7d }, { "pgdn", EXT|0x7a },
+  { "up", EXT|0x75 }, { "down", EXT|0x72 }, { "left", EXT|0x6b }, { "right", EXT|0x74 },
+  { "kp0", 0x70 }, { "kp1", 0x69 }, { "kp2", 0x72 }, { "kp3", 0x7a }, { "kp4", 0x6b },
+  { "kp5", 0x73 }, { "kp6", 0x74 }, { "kp7", 0x6c }, { "kp8", 0x75 }, { "kp9", 0x7d },
+  { "kp.", 0x71 }, { "kp+", 0x79 }, { "kp-", 0x7b }, { "kp*", 0x7c },
+  { "kp/", EXT|0x4a }, { "kpenter", EXT|0x5a },
+  { "numlock", 0x77 }, { "scroll", 0x7e },
+};
+
+// the US layout, a character and its shifted one share a key
+static const struct {
+  char plain, shifted;
+  int code;
+} chars[] = {
+  { 'a', 'A', 0x1c }, { 'b', 'B', 0x32 }, { 'c', 'C', 0x21 }, { 'd', 'D', 0x23 },
+  { 'e', 'E', 0x24 }, { 'f', 'F', 0x2b }, { 'g', 'G', 0x34 }, { 'h', 'H', 0x33 },
+  { 'i', 'I', 0x43 }, { 'j', 'J', 0x3b }, { 'k', 'K', 0x42 }, { 'l', 'L', 0x4b },
+  { 'm', 'M', 0x3a }, { 'n', 'N', 0x31 }, { 'o', 'O', 0x44 }, { 'p', 'P', 0x4d },
+  { 'q', 'Q', 0x15 }, { 'r', 'R', 0x2d }, { 's', 'S', 0x1b }, { 't', 'T', 0x2c },
+  { 'u', 'U', 0x3c }, { 'v', 'V', 0x2a }, { 'w', 'W', 0x1d }, { 'x', 'X', 0x22 },
+  { 'y', 'Y', 0x35 }, { 'z', 'Z', 0x1a },
+  { '1', '!', 0x16 }, { '2', '@', 0x1e }, { '3', '#', 0x26 }, { '4', '$', 0x25 },
+  { '5', '%', 0x2e }, { '6', '^', 0x36 }, { '7', '&', 0x3d }, { '8', '*', 0x3e },
+  { '9', '(', 0x46 }, { '0', ')', 0x45 },
+  { '`', '~', 0x0e }, { '-', '_', 0x4e }, { '=', '+', 0x55 }, { '[', '{', 0x54 },
+  { ']', '}', 0x5b }, { '\\', '|', 0x5d }, { ';', ':', 0x4c }, { '\'', '"', 0x52 },
+  { ',', '<', 0x41 }, { '.', '>', 0x49 }, { '/', '?', 0x4a },
+  { ' ', 0, 0x29 }, { '\n', 0, 0x5a }, { '\t', 0, 0x0d },
+};
+
+static bool modifier(int code) {
+  return code == 0x12 || code == 0x59 || code == 0x14 || code == (EXT|0x14) ||
+    code == 0x11 || code == (EXT|0x11);
+}
+
+static int name_code(const char *n) {
+  for(size_t i=0;i<sizeof(names)/sizeof(names[0]);i++)
+    if(!strcasecmp(n, names[i].name))
+      return names[i].code;
+
+  // a single character is its unshifted key
+  if(n[0] && !n[1])
+    for(size_t i=0;i<sizeof(chars)/sizeof(chars[0]);i++)
+      if(chars[i].plain == tolower(n[0]))
+	return chars[i].code;
+  return -1;
+}
+
+struct stroke {
+  int code;
+  bool shift;
+};
+
+struct event {
+  double time;     // ms
+  int code;
+  bool down;
+  int seq;         // keeps the order of events at the same time
+};
+
+static bool before(const event &a, const event &b) {
+  if(a.time != b.time) return a.time < b.time;
+  if(a.down != b.down) return !a.down;    // releases first
+  return a.seq < b.seq;
+}
+
+static uint32_t seed = 1;
+
+// xorshift, 0..1
+static double rnd() {
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return (seed & 0xffffff) / (double)0x1000000;
+}
+
+static bool parse_text(FILE *f, std::vector<stroke> &s) {
+  int c, line = 1;
+  while((c = fgetc(f)) != EOF) {
+    if(c == '\r') continue;
+    if(c == '\n') line++;
+
+    if(c == '{') {
+      std::string n;
+      while((c = fgetc(f)) != EOF && c != '}' && c != '\n')
+	n += c;
+      int code = name_code(n.c_str());
+      if(c != '}' || code < 0) {
+	fprintf(stderr, "line %d: unknown key {%s}\n", line, n.c_str());
+	return false;
+      }
+      s.push_back( { code, false } );
+      continue;
+    }
+
+    size_t i;
+    for(i=0;i<sizeof(chars)/sizeof(chars[0]);i++)
+      if(chars[i].plain == c || (chars[i].shifted && chars[i].shifted == c))
+	break;
+    if(i == sizeof(chars)/sizeof(chars[0])) {
+      fprintf(stderr, "line %d: no key for character %02x, skipped\n", line, c & 0xff);
+      continue;
+    }
+    s.push_back( { chars[i].code, chars[i].plain != c } );
+  }
+  return true;
+}
+
+// the presses at wpm with their releases, the shift goes down a bit
+// before a run of shifted keys and up a bit after it
+static void type_text(const std::vector<stroke> &s, double wpm, double hold, double jitter,
+		      double overlap, std::vector<event> &ev) {
+  double interval = 12000.0 / wpm;
+  std::vector<double> press(s.size()), release(s.size());
+
+  double t = START_MS + LEAD_MS;
+  for(size_t i=0;i<s.size();i++) {
+    press[i] = t;
+    t += interval * (1 + jitter / 100 * (2 * rnd() - 1));
+  }
+
+  double held = interval * hold / 100;
+  for(size_t i=0;i<s.size();i++) {
+    release[i] = press[i] + held;
+    // a key can't overlap with itself
+    if(i+1 < s.size() && rnd() * 100 < overlap && s[i+1].code != s[i].code &&
+       release[i] < press[i+1] + held / 2)
+      release[i] = press[i+1] + held / 2;
+    ev.push_back( { press[i], s[i].code, true, 0 } );
+    ev.push_back( { release[i], s[i].code, false, 0 } );
+  }
+
+  double lead = std::min(held / 2, (double)LEAD_MS);
+  for(size_t a=0;a<s.size();a++) {
+    if(!s[a].shift) continue;
+    size_t b = a;
+    double up = release[a];
+    while(b+1 < s.size() && s[b+1].shift)
+      up = std::max(up, release[++b]);
+
+    double down = press[a] - lead;
+    if(a && down <= press[a-1]) down = (press[a-1] + press[a]) / 2;
+    up += lead;
+    if(b+1 < s.size() && up >= press[b+1]) up = (press[b] + press[b+1]) / 2;
+    ev.push_back( { down, SHIFT, true, 0 } );
+    ev.push_back( { up, SHIFT, false, 0 } );
+    a = b;
+  }
+}
+
+static bool parse_log(FILE *f, std::vector<event> &ev) {
+  char l[256];
+  int line = 0;
+  while(fgets(l, sizeof(l), f)) {
+    line++;
+    l[strcspn(l, "#\r\n")] = 0;
+
+    double t;
+    char n[64];
+    int r = sscanf(l, "%lf %63s", &t, n);
+    if(r <= 0) continue;
+
+    int code = (r == 2 && (n[0] == '+' || n[0] == '-'))?name_code(n+1):-1;
+    if(code < 0 || t < 0) {
+      fprintf(stderr, "line %d: expected time and +key or -key\n", line);
+      return false;
+    }
+    ev.push_back( { START_MS + t, code, n[0] == '+', 0 } );
+  }
+  return true;
+}
+
+// a key can't go down twice and no more than rollover keys are held,
+// the oldest other than a modifier is released first
+static std::vector<event> rollover(std::vector<event> ev, int max) {
+  for(size_t i=0;i<ev.size();i++) ev[i].seq = i;
+  std::sort(ev.begin(), ev.end(), before);
+
+  std::vector<event> r;
+  std::vector<int> held;
+  for(size_t i=0;i<ev.size();i++) {
+    const event &e = ev[i];
+    std::vector<int>::iterator h = std::find(held.begin(), held.end(), e.code);
+
+    if(!e.down) {
+      if(h == held.end()) continue;
+      held.erase(h);
+      r.push_back(e);
+      continue;
+    }
+
+    if(h != held.end()) {
+      held.erase(h);
+      r.push_back( { e.time, e.code, false, 0 } );
+    }
+
+    while((int)held.size() >= max) {
+      size_t k = 0;
+      while(k < held.size() && modifier(held[k])) k++;
+      if(k == held.size()) k = 0;
+      r.push_back( { e.time, held[k], false, 0 } );
+      held.erase(held.begin() + k);
+    }
+
+    held.push_back(e.code);
+    r.push_back(e);
+  }
+
+  // whatever is still held at the end is released
+  double t = r.empty()?START_MS:r.back().time;
+  for(size_t i=0;i<held.size();i++)
+    r.push_back( { t + 100, held[i], false, 0 } );
+  return r;
+}
+
+// warn about keys ps2.sv ignores
+static void keymap_check(const char *file, const std::vector<event> &ev) {
+  uint8_t keymap[512];
+  FILE *f = fopen(file, "r");
+  if(!f) {
+    fprintf(stderr, "Unable to open keymap %s, keys not checked\n", file);
+    return;
+  }
+
+  char line[256];
+  unsigned int n = 0;
+  while(n < sizeof(keymap) && fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "/")] = 0;
+    for(char *t = strtok(line, " \t\r\n"); t && n < sizeof(keymap); t = strtok(NULL, " \t\r\n"))
+      keymap[n++] = strtoul(t, NULL, 16);
+  }
+  fclose(f);
+
+  std::vector<bool> warned(512, false);
+  for(size_t i=0;i<ev.size();i++) {
+    int c = ev[i].code;
+    if(n == sizeof(keymap) && !(keymap[c] & 0x80) && !warned[c]) {
+      fprintf(stderr, "key %s%02x has no place in the matrix\n", (c & EXT)?"e0 ":"", c & 0xff);
+      warned[c] = true;
+    }
+  }
+}
+
+static void usage(const char *name) {
+  printf("Usage: %s [-w wpm] [-h hold] [-j jitter] [-o overlap] [-r rollover]\n", name);
+  printf("          [-s seed] [-m keymap] text_file\n");
+  printf("       %s [-r rollover] [-m keymap] -k keystroke_log\n", name);
+  printf("  -w  words per minute of five characters (default 60)\n");
+  printf("  -h  time a key is held in %% of the time to the next (default 50)\n");
+  printf("  -j  random variation of the time to the next key in %% (default 20)\n");
+  printf("  -o  %% of the keys still held when the next one goes down (default 0)\n");
+  printf("  -r  most keys held at a time (default 6)\n");
+  printf("  -s  seed of the jitter and the overlap (default 1)\n");
+  printf("  -m  warn about keys not in this keymap (default ../rom/keymap.hex)\n");
+  printf("  -k  the input is a keystroke log of times in ms and +key or -key\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  double wpm = 60, hold = 50, jitter = 20, overlap = 0;
+  int max = 6;
+  bool log = false;
+  const char *keys = "../rom/keymap.hex";
+
+  int c;
+  while((c = getopt(argc, argv, "w:h:j:o:r:s:m:k")) != -1) {
+    switch(c) {
+    case 'w': wpm = atof(optarg); break;
+    case 'h': hold = atof(optarg); break;
+    case 'j': jitter = atof(optarg); break;
+    case 'o': overlap = atof(optarg); break;
+    case 'r': max = atoi(optarg); break;
+    case 's': seed = strtoul(optarg, NULL, 0); break;
+    case 'm': keys = optarg; break;
+    case 'k': log = true; break;
+    default: usage(argv[0]);
+    }
+  }
+
+  if(optind != argc - 1 || wpm <= 0 || hold <= 0 || jitter < 0 || jitter >= 100 ||
+     overlap < 0 || max < 1 || !seed)
+    usage(argv[0]);
+
+  uint32_t first_seed = seed;
+  const char *file = argv[optind];
+  FILE *f = fopen(file, "r");
+  if(!f) {
+    fprintf(stderr, "Unable to open %s\n", file);
+    return 1;
+  }
+
+  std::vector<event> ev;
+  std::vector<stroke> s;
+  bool ok = log?parse_log(f, ev):parse_text(f, s);
+  fclose(f);
+  if(!ok) return 1;
+  if(!log) type_text(s, wpm, hold, jitter, overlap, ev);
+
+  ev = rollover(ev, max);
+  keymap_check(keys, ev);
+
+  const char *base = strrchr(file, '/');
+  base = base?base+1:file;
+  if(log)
+    printf("# keystroke log %s, rollover %d\n", base, max);
+  else
+    printf("# %s typed at %g wpm, hold %g%%, jitter %g%%, overlap %g%%, rollover %d, seed %u\n",
+	   base, wpm, hold, jitter, overlap, max, first_seed);
+
+  long end = ev.empty()?START_MS:lround(ev.back().time);
+  printf("runtime %ld\n\n", (end + TAIL_MS + 9) / 10 * 10);
+  printf("80   text Typing %s\n", base);
+
+  // keys within the same ms are queued by the ps2 keyboard
+  for(size_t i=0;i<ev.size();i++) {
+    int code = ev[i].code;
+    printf("%-4ld ps2k %s%s%02x\n", lround(ev[i].time), (code & EXT)?"e0 ":"",
+	   ev[i].down?"":"f0 ", code & 0xff);
+  }
+  return 0;
+}
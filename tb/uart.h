@@ -0,0 +1,79 @@
+/*
+  uart.h
+
+  Queued uart transmitter for the ikbd's rx line. Messages are
+  appended to a fifo and go out back to back, each byte as a start
+  bit, eight data bits lsb first, a stop bit and gap idle bits. With
+  a gap of 0 the next start bit directly follows the stop bit, which
+  is the full rate of the line.
+
+  The testbench drives the level returned by next() onto rx once per
+  bit time as long as the uart is busy(). It looks at the byte about
+  to start before, so it can take the bit time from the ikbd's rate
+  setting and log the byte.
+*/
+
+#ifndef UART_H
+#define UART_H
+
+#include <stdint.h>
+#include <deque>
+
+// The uart follows the rate the ikbd's sci is set to. Its bit time
+// is 32 to 8192 CLKx2 cycles of 500ns, see HD63701_SCI. The rom sets
+// it to 256 cycles, i.e. 7812.5 bit/s
+static inline uint64_t sci_tpb(uint8_t rmcr) {
+  static const uint64_t tpb_ns[4] = { 16000, 128000, 1024000, 4096000 };
+  return tpb_ns[rmcr & 3];
+}
+
+class uart_tx {
+public:
+  uart_tx() : gap(1), bitn(0) { }
+
+  int gap;     // idle bits after each stop bit
+
+  void send(const uint8_t *data, size_t len) {
+    for(size_t i=0;i<len;i++)
+      fifo.push_back( { data[i], i == 0, i == len-1 ? len : 0 } );
+  }
+
+  bool busy() const { return !fifo.empty(); }
+
+  // bytes waiting incl. the one being sent
+  size_t queued() const { return fifo.size(); }
+
+  // the next bit is the start bit of the first byte in the fifo
+  bool start_bit() const { return bitn == 0; }
+  bool stop_bit() const { return bitn == 9; }
+  uint8_t byte() const { return fifo.front().value; }
+  bool msg_first() const { return fifo.front().first; }
+
+  // level of the next bit. The byte leaves the fifo with its last
+  // idle bit, if that ends a message its length is returned in done
+  int next(size_t *done) {
+    const entry &e = fifo.front();
+    int level = 1;
+    if(bitn == 0)     level = 0;
+    else if(bitn < 9) level = (e.value >> (bitn-1)) & 1;
+
+    *done = 0;
+    if(++bitn >= 10 + gap) {
+      *done = e.msg_len;
+      fifo.pop_front();
+      bitn = 0;
+    }
+    return level;
+  }
+
+private:
+  struct entry {
+    uint8_t value;
+    bool first;        // first byte of a message
+    size_t msg_len;    // set on the last byte of a message
+  };
+  std::deque<entry> fifo;
+  int bitn;            // bit of the first byte to be sent next
+};
+
+#endif // UART_H